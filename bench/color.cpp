@@ -0,0 +1,97 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include "../src/format/image-ppm.h"
+#include "../src/process.h"
+
+// Planes of a colour conversion
+struct Planes {
+    Bitmap<unsigned char> R, G, B, gray;
+    Bitmap<float> Y, Cr, Cb;
+};
+
+// Conversions of an image (and back from the given planes) with an instruction set, the time of each round is returned
+double convert(Process::Simd simd, const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B,
+               const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitmap<float>& Cb, Planes& out, unsigned int rounds) {
+    Process::useSimd(simd);
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned int r = 0; r < rounds; r++) {
+        Process::toYCrCb(R, G, B, out.Y, out.Cr, out.Cb);
+        Process::toRGB(Y, Cr, Cb, out.R, out.G, out.B);
+        Process::toGrayscale(R, G, B, out.gray);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count() / rounds;
+}
+
+template <typename T>
+bool same(const Bitmap<T>& a, const Bitmap<T>& b) {
+    return a.width() == b.width() && a.height() == b.height() && std::memcmp(a.data(), b.data(), (std::size_t)a.width() * a.height() * sizeof(T)) == 0;
+}
+
+bool same(const Planes& a, const Planes& b) {
+    return same(a.R, b.R) && same(a.G, b.G) && same(a.B, b.B) && same(a.gray, b.gray) && same(a.Y, b.Y) && same(a.Cr, b.Cr) && same(a.Cb, b.Cb);
+}
+
+// Compare the vectorized colour conversions to the scalar ones (all the RGB colours, then the images), with their throughput
+int main(int argc, char * argv[]) {
+    const char * const names[3] = { "scalar", "sse2", "avx2" };
+    const unsigned int ROUNDS = 10;
+    Process::Simd supported = Process::supportedSimd();
+    std::cout << "supported : " << names[supported] << std::endl;
+    bool ok = true;
+
+    // Every RGB colour, the way back from noisy planes out of [0, 255]
+    {
+        Bitmap<unsigned char> R(4096, 4096), G(4096, 4096), B(4096, 4096);
+        Bitmap<float> Y(4096, 4096), Cr(4096, 4096), Cb(4096, 4096);
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> values(-40.0f, 300.0f);
+        for (std::size_t k = 0; k < (std::size_t)4096 * 4096; k++) {
+            R.data()[k] = (unsigned char)(k >> 16);
+            G.data()[k] = (unsigned char)(k >> 8);
+            B.data()[k] = (unsigned char)k;
+            Y.data()[k] = values(random);
+            Cr.data()[k] = values(random);
+            Cb.data()[k] = values(random);
+        }
+        Planes ref;
+        convert(Process::SIMD_NONE, R, G, B, Y, Cr, Cb, ref, 1);
+        for (unsigned int s = 1; s <= supported; s++) {
+            Planes out;
+            convert((Process::Simd)s, R, G, B, Y, Cr, Cb, out, 1);
+            bool equal = same(ref, out);
+            ok = ok && equal;
+            std::cout << "all colours\t" << names[s] << "\t" << (equal ? "same" : "MISMATCH") << std::endl;
+        }
+    }
+
+    for (int a = 1; a < argc; a++) {
+        ImagePPM im;
+        if (!im.load(argv[a]) || !im.colored())
+            continue;
+        Planes ref;
+        Bitmap<float> Y, Cr, Cb;
+        Process::toYCrCb(im.getRed(), im.getGreen(), im.getBlue(), Y, Cr, Cb);
+        double base = 0.0, mb = (double)im.width() * im.height() / 1e6;
+        for (unsigned int s = 0; s <= supported; s++) {
+            Planes out;
+            double time = convert((Process::Simd)s, im.getRed(), im.getGreen(), im.getBlue(), Y, Cr, Cb, out, ROUNDS);
+            if (s == 0) {
+                base = time;
+                ref = out;
+            }
+            bool equal = same(ref, out);
+            ok = ok && equal;
+            std::cout << argv[a] << "\t" << names[s]
+                      << "\t" << mb / time << " Mpx/s"
+                      << "\tx" << base / time
+                      << "\t" << (equal ? "same" : "MISMATCH") << std::endl;
+        }
+    }
+    Process::useSimd(supported);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+
+#include "../src/format/image-ppm.h"
+#include "../src/process.h"
+#include "../src/huffman.h"
+#include "../src/rans.h"
+
+// Symbols decoding throughput : Huffman decoding tables and interleaved rANS against the Huffman tree walk
+int main(int argc, char * argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage : " << argv[0] << " <image.[pgm|ppm]>..." << std::endl;
+        return -1;
+    }
+
+    const unsigned int ROUNDS = 10;
+    for (int a = 1; a < argc; a++) {
+        ImagePPM im;
+        if (!im.load(argv[a]))
+            continue;
+        Bitmap<unsigned char> Y;
+        if (im.colored())
+            Process::toGrayscale(im.getRed(), im.getGreen(), im.getBlue(), Y);
+        else
+            Y = im.getGrayscale();
+        unsigned int count = Y.width() * Y.height();
+
+        for (unsigned int N : { 3, 6, 8 }) {
+            Bitmap<unsigned char> YQ;
+            Bitmap<float> Yf;
+            Yf = Y;
+            Process::Quantify(Yf, YQ, N);
+            BitWriter stream;
+            Huffman<8> enc, huff;
+            enc.create(YQ.data(), count, N);
+            enc.write(stream, N);
+            enc.write(stream, YQ.data(), count, N);
+            const std::vector<unsigned char>& bytes = stream.flush();
+            BitReader header(bytes);
+            unsigned int offset = huff.read(header, N);
+
+            std::array<unsigned int, 256> histo;
+            Process::histogram(YQ, histo);
+            BitWriter rstream;
+            Rans renc, rdec;
+            renc.create(histo, N);
+            renc.write_table(rstream, N);
+            renc.write(rstream, YQ.data(), count, N);
+            const std::vector<unsigned char>& rbytes = rstream.flush();
+            BitReader rheader(rbytes);
+            unsigned int roffset = rdec.read_table(rheader, N);
+
+            Bitmap<unsigned char> out1(Y.width(), Y.height()), out2(Y.width(), Y.height()), out3(Y.width(), Y.height());
+            auto t0 = std::chrono::steady_clock::now();
+            for (unsigned int r = 0; r < ROUNDS; r++) {
+                BitReader dta(bytes);
+                dta.skip(offset);
+                huff.read_walk(dta, out1.data(), count);
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            for (unsigned int r = 0; r < ROUNDS; r++) {
+                BitReader dta(bytes);
+                dta.skip(offset);
+                huff.read(dta, out2.data(), count);
+            }
+            auto t2 = std::chrono::steady_clock::now();
+            for (unsigned int r = 0; r < ROUNDS; r++) {
+                BitReader dta(rbytes);
+                dta.skip(roffset);
+                rdec.read(dta, out3.data(), count);
+            }
+            auto t3 = std::chrono::steady_clock::now();
+
+            double walk = std::chrono::duration<double>(t1 - t0).count(),
+                   tbl = std::chrono::duration<double>(t2 - t1).count(),
+                   rans = std::chrono::duration<double>(t3 - t2).count(),
+                   mb = (double)count * ROUNDS / 1e6;
+            bool same = std::memcmp(out1.data(), out2.data(), count) == 0 && std::memcmp(out1.data(), out3.data(), count) == 0;
+            std::cout << argv[a] << "\tN=" << N
+                      << "\twalk " << mb / walk << " MS/s"
+                      << "\ttable " << mb / tbl << " MS/s"
+                      << "\tx" << walk / tbl
+                      << "\trans " << mb / rans << " MS/s"
+                      << "\tx" << walk / rans
+                      << "\t" << stream.size() << " / " << rstream.size() << " bits"
+                      << (same ? "" : "\tMISMATCH") << std::endl;
+            if (!same)
+                return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "../src/format/image-ppm.h"
+#include "../src/process.h"
+#include "../src/thread-pool.h"
+
+// Pixel kernels of a filtered mode encoding and decoding
+void kernels(const ImagePPM& im, Bitmap<unsigned char>& R, Bitmap<unsigned char>& G, Bitmap<unsigned char>& B) {
+    Bitmap<float> Y, Cr, Cb, YMean, YDiff, Cr2, Cb2, Y2, YMean2, YDiff2;
+    Bitmap<unsigned char> YMeanQ, YDiffQ, CrQ, CbQ;
+    Process::toYCrCb(im.getRed(), im.getGreen(), im.getBlue(), Y, Cr, Cb);
+    Process::filterMean(Y, YMean);
+    Process::filterSub(Y, YDiff);
+    Process::Quantify(YMean, YMeanQ, 7);
+    Process::grayCoding(YMeanQ, YMeanQ);
+    Process::LogQuantify(YDiff, YDiffQ, 6);
+    Process::Reduce2(Cr, Cr2);
+    Process::Reduce2(Cb, Cb2);
+    Process::Quantify(Cr2, CrQ, 7);
+    Process::Quantify(Cb2, CbQ, 7);
+    Process::invertGrayCoding(YMeanQ, YMeanQ);
+    Process::Unquantify(YMeanQ, YMean2, 7);
+    Process::LogUnquantify(YDiffQ, YDiff2, 6);
+    Process::invertFilter(YMean2, YDiff2, Y2);
+    Process::Unquantify(CrQ, Cr2, 7);
+    Process::Unquantify(CbQ, Cb2, 7);
+    Process::Enlarge2(Cr2, Cr);
+    Process::Enlarge2(Cb2, Cb);
+    Process::toRGB(Y2, Cr, Cb, R, G, B);
+}
+
+// Pixel kernels throughput for 1 to N threads (the hardware concurrency by default), the images must be the same for all the counts
+int main(int argc, char * argv[]) {
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    int first = 1;
+    if (argc > 2 && std::string(argv[1]) == "-j") {
+        threads = std::max(1, std::atoi(argv[2]));
+        first = 3;
+    }
+    if (argc <= first) {
+        std::cerr << "usage : " << argv[0] << " [-j <threads>] <image.ppm>..." << std::endl;
+        return -1;
+    }
+
+    const unsigned int ROUNDS = 10;
+    for (int a = first; a < argc; a++) {
+        ImagePPM im;
+        if (!im.load(argv[a]) || !im.colored())
+            continue;
+        unsigned int count = im.width() * im.height();
+        Bitmap<unsigned char> ref[3];
+        double base = 0.0;
+        for (unsigned int t = 1; t <= threads; t++) {
+            ThreadPool::global().resize(t);
+            Bitmap<unsigned char> out[3];
+            auto t0 = std::chrono::steady_clock::now();
+            for (unsigned int r = 0; r < ROUNDS; r++)
+                kernels(im, out[0], out[1], out[2]);
+            auto t1 = std::chrono::steady_clock::now();
+            double time = std::chrono::duration<double>(t1 - t0).count(), mb = (double)count * ROUNDS / 1e6;
+            if (t == 1) {
+                base = time;
+                for (unsigned int c = 0; c < 3; c++)
+                    ref[c] = out[c];
+            }
+            bool same = true;
+            for (unsigned int c = 0; c < 3; c++)
+                same = same && std::memcmp(ref[c].data(), out[c].data(), (std::size_t)out[c].width() * out[c].height()) == 0;
+            std::cout << argv[a] << "\tthreads=" << t
+                      << "\t" << mb / time << " Mpx/s"
+                      << "\tx" << base / time
+                      << (same ? "" : "\tMISMATCH") << std::endl;
+        }
+    }
+
+    return 0;
+}
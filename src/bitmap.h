@@ -592,8 +592,8 @@ public:
         T * tmp = new T[width * height];
         if (d != 0) {
             if (copy_data) {
-                for (unsigned int i = 0; i < height && i + offset_i < w; i++) {
-                    for (unsigned int j = 0; j < width && j + offset_j < h; j++) {
+                for (unsigned int i = 0; i < height && i + offset_i < h; i++) {
+                    for (unsigned int j = 0; j < width && j + offset_j < w; j++) {
                         tmp[i * width + j] = d[(i + offset_i) * w + j + offset_j];
                     }
                 }
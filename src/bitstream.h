@@ -0,0 +1,138 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Bits writer through a 64 bits accumulator (bits are packed from the least significant bit of each byte)
+class BitWriter {
+
+    // Completed bytes
+    std::vector<unsigned char> bytes;
+
+    // Pending bits
+    uint64_t buffer;
+
+    // Pending bits count (always lower than 64)
+    unsigned int count;
+
+public:
+
+    BitWriter() : buffer(0), count(0) {}
+
+    // Number of written bits
+    std::size_t size() const { return bytes.size() * 8 + count; }
+
+    // Write the n (up to 64) least significant bits of a value
+    void write(uint64_t value, unsigned int n) {
+        if (n == 0)
+            return;
+        if (n < 64)
+            value &= ((uint64_t)1 << n) - 1;
+        buffer |= value << count;
+        if (count + n < 64) {
+            count += n;
+            return;
+        }
+        for (unsigned int i = 0; i < 64; i += 8)
+            bytes.push_back((unsigned char)(buffer >> i));
+        unsigned int used = 64 - count;
+        buffer = (used < 64) ? value >> used : 0;
+        count = count + n - 64;
+    }
+
+    // Write a single bit
+    void write(bool bit) { write((uint64_t)bit, 1); }
+
+    // Write all the bits of another writer
+    void append(const BitWriter& other) {
+        for (unsigned char c : other.bytes)
+            write(c, 8);
+        write(other.buffer, other.count);
+    }
+
+    // Pad pending bits to a whole byte and give the written bytes
+    const std::vector<unsigned char>& flush() {
+        for (; count > 0; count = (count > 8) ? count - 8 : 0, buffer >>= 8)
+            bytes.push_back((unsigned char)buffer);
+        buffer = 0;
+        return bytes;
+    }
+
+};
+
+// Bits reader over a bytes buffer (bits after the end of the buffer read as zeros)
+class BitReader {
+
+    // Buffer
+    const unsigned char * bytes;
+
+    // Buffer size in bytes
+    std::size_t length;
+
+    // Current position in bits
+    std::size_t pos;
+
+public:
+
+    BitReader() : bytes(0), length(0), pos(0) {}
+    BitReader(const unsigned char * data, std::size_t size) : bytes(data), length(size), pos(0) {}
+    BitReader(const std::vector<unsigned char>& data) : bytes(data.data()), length(data.size()), pos(0) {}
+
+    // Current position in bits
+    std::size_t position() const { return pos; }
+
+    // Buffer size in bits
+    std::size_t size() const { return length * 8; }
+
+    // Give the next n (up to 56) bits without consuming them
+    uint64_t peek(unsigned int n) const {
+        std::size_t byte = pos / 8;
+        uint64_t value = 0;
+        if (byte + 8 <= length) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            std::memcpy(&value, bytes + byte, 8);
+#else
+            for (unsigned int i = 0; i < 8; i++)
+                value |= (uint64_t)bytes[byte + i] << (i * 8);
+#endif
+        }
+        else {
+            for (unsigned int i = 0; byte + i < length; i++)
+                value |= (uint64_t)bytes[byte + i] << (i * 8);
+        }
+        return (value >> (pos % 8)) & (((uint64_t)1 << n) - 1);
+    }
+
+    // Consume n bits
+    void skip(std::size_t n) { pos += n; }
+
+    // Read the next n (up to 64) bits
+    uint64_t read(unsigned int n) {
+        if (n > 56) {
+            uint64_t low = read(32);
+            return low | (read(n - 32) << 32);
+        }
+        uint64_t value = peek(n);
+        pos += n;
+        return value;
+    }
+
+    // Read a single bit
+    bool bit() { return read(1) != 0; }
+
+    // Read the next 8 bits
+    unsigned int byte() {
+        std::size_t i = pos / 8;
+        unsigned int shift = pos % 8, value = (i < length) ? bytes[i] >> shift : 0;
+        if (shift && i + 1 < length)
+            value |= bytes[i + 1] << (8 - shift);
+        pos += 8;
+        return value & 0xFF;
+    }
+
+};
+
+#endif // BITSTREAM_H
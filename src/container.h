@@ -0,0 +1,158 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "bitstream.h"
+#include "stream.h"
+
+// Planes of a compressed image
+enum SectionPlane {
+    Y_PLANE = 0,        // luminance (or its mean for the filtered mode)
+    YDIFF_PLANE = 1,    // luminance details of the filtered mode
+    CR_PLANE = 2,
+    CB_PLANE = 3
+};
+
+// Plane of a wavelet subband (bands numbered from the coarsest)
+inline unsigned char bandPlane(unsigned char plane, unsigned int band) {
+    return (unsigned char)(plane | (band << 2));
+}
+
+// Content of a section
+enum SectionCodec {
+    SYMBOLS_SECTION = 0,    // low bits by a symbols coder
+    BITPLANES_SECTION = 1   // high bits by the bitplanes coders
+};
+
+// Byte aligned sub-stream located by the sections table
+struct Section {
+    unsigned char plane;
+    unsigned char codec;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Sections table followed by the sections content : sections count on a byte, then for each
+// section its plane, its codec, its offset (from the end of the table) and its length in bytes
+class Container {
+
+    // Sections table
+    std::vector<Section> table;
+
+    // Sections content
+    std::vector<unsigned char> data;
+
+    // Reader of each section
+    std::vector<BitReader> readers;
+
+    // Readers of the missing sections (reading zeros), kept apart so that each plane reads its own
+    std::deque<BitReader> missing;
+
+    // No sections table, the single section is shared by all the planes
+    bool flat;
+
+    // Read the remaining bytes of a stream (at most limit bytes)
+    static void load(LiteScript::IStreamer& stream, std::vector<unsigned char>& bytes, std::size_t limit = (std::size_t)-1) {
+        const std::size_t BLOCK = 1 << 16;
+        std::size_t size = 0, block;
+        do {
+            block = std::min(BLOCK, limit - size);
+            bytes.resize(size + block);
+            size += stream.read(bytes.data() + size, block);
+        } while (size == bytes.size() && size < limit);
+        bytes.resize(size);
+    }
+
+public:
+
+    Container() : flat(false) {}
+
+    // Sections count
+    std::size_t size() const { return table.size(); }
+
+    // The planes share a single section (read in the planes order)
+    bool shared() const { return flat; }
+
+    // Section descriptor
+    const Section& operator[](std::size_t i) const { return table[i]; }
+
+    // Add a section from a bits stream (padded to a whole byte)
+    void add(unsigned char plane, unsigned char codec, BitWriter& bits) {
+        const std::vector<unsigned char>& bytes = bits.flush();
+        Section section = { plane, codec, (uint32_t)data.size(), (uint32_t)bytes.size() };
+        table.push_back(section);
+        data.insert(data.end(), bytes.begin(), bytes.end());
+    }
+
+    // Write the sections table and content
+    void write(LiteScript::OStreamer& stream) const {
+        stream << (unsigned char)table.size();
+        for (const Section& section : table)
+            stream << section.plane << section.codec << (unsigned int)section.offset << (unsigned int)section.length;
+        stream.write(data.data(), data.size());
+    }
+
+    // Read the sections table and content (sections out of the content are dropped)
+    void read(LiteScript::IStreamer& stream) {
+        readTable(stream);
+        readContent(stream);
+    }
+
+    // Read the sections table only
+    void readTable(LiteScript::IStreamer& stream) {
+        unsigned char count;
+        stream >> count;
+        flat = false;
+        table.clear();
+        for (unsigned int i = 0; i < count; i++) {
+            Section section;
+            unsigned int offset, length;
+            stream >> section.plane >> section.codec >> offset >> length;
+            section.offset = offset;
+            section.length = length;
+            table.push_back(section);
+        }
+    }
+
+    // Read the first bytes of the sections content (the sections after them are dropped)
+    void readContent(LiteScript::IStreamer& stream, std::size_t size = (std::size_t)-1) {
+        load(stream, data, size);
+        readers.clear();
+        missing.clear();
+        for (std::size_t i = 0; i < table.size(); i++) {
+            if (table[i].offset > data.size() || table[i].length > data.size() - table[i].offset)
+                table[i].length = 0;
+            readers.push_back(BitReader(data.data() + (table[i].length ? table[i].offset : 0), table[i].length));
+        }
+    }
+
+    // Read a stream without sections table as a single section shared by all the planes
+    void readFlat(LiteScript::IStreamer& stream) {
+        load(stream, data);
+        flat = true;
+        Section section = { 0, 0, 0, (uint32_t)data.size() };
+        table.assign(1, section);
+        readers.assign(1, BitReader(data));
+        missing.clear();
+    }
+
+    // Reader of a section
+    BitReader& open(unsigned char plane, unsigned char codec) {
+        if (flat)
+            return readers[0];
+        for (std::size_t i = 0; i < table.size(); i++) {
+            if (table[i].plane == plane && table[i].codec == codec)
+                return readers[i];
+        }
+        missing.push_back(BitReader());
+        return missing.back();
+    }
+
+};
+
+#endif // CONTAINER_H
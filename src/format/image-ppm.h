@@ -1,6 +1,8 @@
 #ifndef IMAGE_PPM_H
 #define IMAGE_PPM_H
 
+#include <fstream>
+
 #include "../image.h"
 
 class ImagePPM : public Image {
@@ -28,4 +30,27 @@ public:
 
 };
 
+// Reader of a PPM / PGM file a strip of rows at a time
+class ImagePPMReader {
+
+    std::ifstream file;
+    unsigned int w, h, row;
+    bool color;
+
+public:
+
+    ImagePPMReader() : w(0), h(0), row(0), color(false) {}
+
+    // Open a file and read its header
+    bool open(const char * filename);
+
+    unsigned int width() const { return w; }
+    unsigned int height() const { return h; }
+    bool colored() const { return color; }
+
+    // Read the next rows (at most count) into an image
+    bool read(ImagePPM& strip, unsigned int count);
+
+};
+
 #endif // IMAGE_PPM_H
\ No newline at end of file
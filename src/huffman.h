@@ -9,17 +9,27 @@
 #include <memory>
 #include <algorithm>
 #include <iomanip>
+#include <string>
+#include <cstdint>
+
+#include "bitstream.h"
 
 template <int N = 8>
 class Huffman {
 
+    // Code (bits in stream order, from the least significant one)
+    struct Code {
+        uint64_t bits;
+        unsigned int length;
+    };
+
     // Frequency node
     class Node {
         
     public:
 
         // Frequency counter
-        float freq;
+        unsigned int freq;
         
         // Value (null if node)
         std::unique_ptr<std::bitset<N>> value;
@@ -30,12 +40,12 @@ class Huffman {
     private:
 
         // Default constructor
-        Node() : freq(0.0f) {}
+        Node() : freq(0) {}
 
     public:
 
         // Leave constructor
-        Node(unsigned int v, float f) {
+        Node(unsigned int v, unsigned int f) {
             freq = f;
             value = std::move(std::unique_ptr<std::bitset<N>>(new std::bitset<N>(v)));
         }
@@ -53,62 +63,74 @@ class Huffman {
         }
 
         // Console output displaying
-        void display(std::vector<bool>& bv) {
+        void display(std::string& code) {
             if (leave())
-                std::cout << value->to_ulong() << "\t" << std::setprecision(4) << freq << "\t\t" << bv << std::endl;
+                std::cout << value->to_ulong() << "\t" << freq << "\t\t" << code << std::endl;
             else {
-                bv.push_back(0);
-                left->display(bv);
-                bv.back() = 1;
-                right->display(bv);
-                bv.pop_back();
+                code.push_back('0');
+                left->display(code);
+                code.back() = '1';
+                right->display(code);
+                code.pop_back();
             }
         }
 
-        void fill_codes(std::array<std::vector<bool>, 1 << N>& codes, std::vector<bool>& bv) {
+        void fill_codes(std::array<Code, 1 << N>& codes, uint64_t bits = 0, unsigned int length = 0) {
             if (leave())
-                codes[value->to_ulong()] = bv;
+                codes[value->to_ulong()] = Code { bits, length };
             else {
-                bv.push_back(0);
-                left->fill_codes(codes, bv);
-                bv.back() = 1;
-                right->fill_codes(codes, bv);
-                bv.pop_back();
+                left->fill_codes(codes, bits, length + 1);
+                right->fill_codes(codes, bits | ((uint64_t)1 << length), length + 1);
             }
         }
 
         // Write the tree content
-        void write(std::vector<bool>& stream, unsigned int elem_size = N) {
+        void write(BitWriter& stream, unsigned int elem_size = N) {
             if (leave()) {
-                stream.push_back(1);
-                for (unsigned int i = 0; i < elem_size; i++)
-                    stream.push_back(value->operator[](i));
+                stream.write(true);
+                stream.write(value->to_ulong(), elem_size);
             }
             else {
-                stream.push_back(0);
+                stream.write(false);
                 left->write(stream, elem_size);
                 right->write(stream, elem_size);
             }
         }
 
         // Read the tree content
-        static Node * read(const std::vector<bool>& stream, unsigned int& it, unsigned int elem_size = N) {
+        static Node * read(BitReader& stream, unsigned int elem_size = N) {
             Node * node = new Node();
-            if (stream[it++] == 1) {
-                node->value = std::move(std::unique_ptr<std::bitset<N>>(new std::bitset<N>()));
-                for (unsigned int i = 0; i < elem_size; i++)
-                    node->value->operator[](i) = stream[it++];
+            if (stream.bit()) {
+                node->value = std::move(std::unique_ptr<std::bitset<N>>(new std::bitset<N>(stream.read(elem_size))));
             }
             else {
-                node->left = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, it, elem_size)));
-                node->right = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, it, elem_size)));
+                node->left = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, elem_size)));
+                node->right = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, elem_size)));
             }
             return node;
         }
 
-        // Greater comparison
-        static bool greater(Node * a, Node * b) {
-            return a->freq > b->freq;
+        // Tree of codes (bits in stream order, a left child for a null bit), the frequencies summed from the leaves
+        static Node * tree(const std::array<Code, 1 << N>& codes, const std::vector<unsigned int>& alphabet, const std::array<unsigned int, 1 << N>& freqs) {
+            Node * root = new Node();
+            for (unsigned int s : alphabet) {
+                Node * node = root;
+                node->freq += freqs[s];
+                for (unsigned int i = 0; i < codes[s].length; i++) {
+                    std::unique_ptr<Node>& child = ((codes[s].bits >> i) & 0x1) ? node->right : node->left;
+                    if (!child)
+                        child = std::move(std::unique_ptr<Node>(new Node()));
+                    node = child.get();
+                    node->freq += freqs[s];
+                }
+                node->value = std::move(std::unique_ptr<std::bitset<N>>(new std::bitset<N>(s)));
+            }
+            return root;
+        }
+
+        // Lower comparison
+        static bool lower(Node * a, Node * b) {
+            return a->freq < b->freq;
         }
 
     };
@@ -117,93 +139,348 @@ class Huffman {
     std::unique_ptr<Node> ftree;
 
     // Codes array
-    std::array<std::vector<bool>, 1 << N> codes;
+    std::array<Code, 1 << N> codes;
+
+    // Coded symbols
+    std::vector<unsigned int> alphabet;
+
+    // Decoding table entry (symbol if link is null, else sub-table offset and index size)
+    struct Entry {
+        unsigned int value;
+        unsigned char length;
+        unsigned char link;
+    };
+
+    // Maximum index size of a decoding table
+    static const unsigned int TABLE_BITS = 10;
+
+    // Decoding tables (primary table first, then sub-tables)
+    std::vector<Entry> table;
+
+    // Primary decoding table index size
+    unsigned int table_bits;
+
+    // Build the decoding table of the codes sharing a prefix of a given depth
+    unsigned int build_table(const std::vector<unsigned int>& symbols, unsigned int depth, unsigned int& bits) {
+        unsigned int maxlen = depth;
+        for (unsigned int s : symbols)
+            maxlen = std::max(maxlen, codes[s].length);
+        bits = std::min((unsigned int)TABLE_BITS, maxlen - depth);
+        unsigned int offset = table.size();
+        table.resize(offset + (1 << bits), Entry { 0, 0, 0 });
+        std::vector<std::vector<unsigned int>> links(1 << bits);
+        for (unsigned int s : symbols) {
+            const Code& code = codes[s];
+            unsigned int len = std::min(bits, code.length - depth),
+                         index = (unsigned int)(code.bits >> depth) & ((1 << len) - 1);
+            if (code.length - depth > bits)
+                links[index].push_back(s);
+            else {
+                for (unsigned int i = index; i < (1u << bits); i += (1 << len))
+                    table[offset + i] = Entry { s, (unsigned char)len, 0 };
+            }
+        }
+        for (unsigned int i = 0; i < (1u << bits); i++) {
+            if (links[i].empty())
+                continue;
+            unsigned int sub_bits, sub = build_table(links[i], depth + bits, sub_bits);
+            table[offset + i] = Entry { sub, (unsigned char)bits, (unsigned char)sub_bits };
+        }
+        return offset;
+    }
+
+    // Element of a data array packed on N bits
+    static unsigned int element(const void * data, std::size_t i, unsigned int elem_size) {
+        if (N == 8)
+            return ((const unsigned char *)data)[i] & ((1 << elem_size) - 1);
+        unsigned int elem = 0;
+        for (unsigned int j = 0; j < elem_size; j++) {
+            unsigned long nbB = (unsigned long)i * (unsigned long)N + (unsigned long)j;
+            elem |= ((((const unsigned char *)data)[nbB / 8] >> (nbB % 8)) & 0x1) << j;
+        }
+        return elem;
+    }
 
     // Reload codes
     void reload_codes() {
         for (unsigned int i = 0; i < (1 << N); i++)
-            codes[i].clear();
-        std::vector<bool> bv;
-        ftree->fill_codes(codes, bv);
+            codes[i] = Code { 0, 0 };
+        ftree->fill_codes(codes);
+        alphabet.clear();
+        for (unsigned int i = 0; i < (1 << N); i++) {
+            if (codes[i].length != 0 || (ftree->leave() && ftree->value->to_ulong() == i))
+                alphabet.push_back(i);
+        }
+    }
+
+    // Recompute optimal code lengths bounded by maxlen (package-merge)
+    void limit(const std::array<unsigned int, 1 << N>& freqs, unsigned int maxlen) {
+        std::vector<unsigned int> symbols(alphabet);
+        std::stable_sort(symbols.begin(), symbols.end(), [&freqs](unsigned int a, unsigned int b) {
+            return freqs[a] < freqs[b];
+        });
+        std::size_t n = symbols.size();
+        while (((std::size_t)1 << maxlen) < n)
+            maxlen++;
+        // Each level merges the leaves with the pairs of items of the previous level
+        std::vector<std::vector<uint64_t>> weights(maxlen);
+        std::vector<std::vector<int>> items(maxlen);
+        for (unsigned int k = 0; k < maxlen; k++) {
+            std::size_t li = 0, pi = 0, packages = (k == 0) ? 0 : weights[k - 1].size() / 2;
+            while (li < n || pi < packages) {
+                uint64_t package = (pi < packages) ? weights[k - 1][pi * 2] + weights[k - 1][pi * 2 + 1] : 0;
+                if (li < n && (pi >= packages || freqs[symbols[li]] <= package)) {
+                    weights[k].push_back(freqs[symbols[li]]);
+                    items[k].push_back((int)symbols[li++]);
+                }
+                else {
+                    weights[k].push_back(package);
+                    items[k].push_back(-1);
+                    pi++;
+                }
+            }
+        }
+        // The 2n-2 lightest items of the last level give the number of levels where each symbol is used
+        for (unsigned int s : alphabet)
+            codes[s].length = 0;
+        std::size_t take = 2 * n - 2;
+        for (unsigned int k = maxlen; k-- > 0 && take > 0; ) {
+            std::size_t packages = 0;
+            for (std::size_t i = 0; i < take; i++) {
+                if (items[k][i] < 0)
+                    packages++;
+                else
+                    codes[items[k][i]].length++;
+            }
+            take = packages * 2;
+        }
+        canonize();
+        ftree = std::move(std::unique_ptr<Node>(Node::tree(codes, alphabet, freqs)));
+    }
+
+    // Reload decoding tables
+    void reload_table() {
+        table.clear();
+        build_table(alphabet, 0, table_bits);
+    }
+
+    // Replace codes by the canonical codes of the same lengths
+    void canonize() {
+        std::stable_sort(alphabet.begin(), alphabet.end(), [this](unsigned int a, unsigned int b) {
+            return codes[a].length < codes[b].length;
+        });
+        uint64_t code = 0;
+        unsigned int len = 0;
+        for (unsigned int s : alphabet) {
+            code <<= codes[s].length - len;
+            len = codes[s].length;
+            codes[s].bits = 0;
+            for (unsigned int i = 0; i < len; i++)
+                codes[s].bits |= ((code >> (len - 1 - i)) & 0x1) << i;
+            code++;
+        }
     }
     
 public:
 
-    // Create a frequency tree
-    void create(const void * data, std::size_t count, unsigned int elem_size = N) {
-        std::array<unsigned int, 1 << N> freqs;
-        for (unsigned int i = 0; i < (1 << N); i++)
-            freqs[i] = 0;
-        for (unsigned int i = 0; i < count; i++) {
-            std::bitset<N> elem;
-            for (unsigned int j = 0; j < elem_size; j++) {
-                unsigned long nbB = (unsigned long)i * (unsigned long)N + (unsigned long)j;
-                elem[j] = (((unsigned char *)data)[(unsigned int)(nbB / (unsigned long)8)] >> (nbB % 8)) & 0x1;
-            }
-            freqs[elem.to_ulong()]++;
+    // Count the elements of a data array
+    static void histogram(const void * data, std::size_t count, std::array<unsigned int, 1 << N>& freqs, unsigned int elem_size = N) {
+        freqs.fill(0);
+        if (N != 8) {
+            for (std::size_t i = 0; i < count; i++)
+                freqs[element(data, i, elem_size)]++;
+            return;
         }
-        std::vector<Node *> nodes;
+        // Four counting tables, so that runs of a same byte do not serialize on one counter
+        std::array<std::array<unsigned int, 256>, 4> counts;
+        for (unsigned int t = 0; t < 4; t++)
+            counts[t].fill(0);
+        const unsigned char * bytes = (const unsigned char *)data;
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            counts[0][bytes[i]]++;
+            counts[1][bytes[i + 1]]++;
+            counts[2][bytes[i + 2]]++;
+            counts[3][bytes[i + 3]]++;
+        }
+        for (; i < count; i++)
+            counts[0][bytes[i]]++;
+        for (unsigned int v = 0; v < 256; v++)
+            freqs[v & ((1 << elem_size) - 1)] += counts[0][v] + counts[1][v] + counts[2][v] + counts[3][v];
+    }
+
+    // Create a frequency tree from elements counts (counts of values wider than elem_size bits are folded),
+    // with codes no longer than maxlen bits if not null (the tree is then rebuilt from the canonical codes)
+    void create(const std::array<unsigned int, 1 << N>& freqs, unsigned int elem_size = N, unsigned int maxlen = 0) {
+        std::array<unsigned int, 1 << N> folded;
+        folded.fill(0);
+        for (unsigned int i = 0; i < (1 << N); i++)
+            folded[i & ((1 << elem_size) - 1)] += freqs[i];
+        // Two queues merge : sorted leaves, and nodes which are created by increasing frequency
+        std::vector<Node *> leaves, nodes;
         for (unsigned int i = 0; i < (1 << N); i++) {
-            if (freqs[i] != 0)
-                nodes.push_back(new Node(i, (float)freqs[i] / (float)count));
-        }
-        while (nodes.size() > 1) {
-            std::sort(nodes.begin(), nodes.end(), Node::greater);
-            Node * r = nodes.back();
-            nodes.pop_back();
-            Node * l = nodes.back();
-            nodes.pop_back();
+            if (folded[i] != 0)
+                leaves.push_back(new Node(i, folded[i]));
+        }
+        // Without any element, a single symbol code of the value 0
+        if (leaves.empty())
+            leaves.push_back(new Node(0u, 0u));
+        std::stable_sort(leaves.begin(), leaves.end(), Node::lower);
+        std::size_t li = 0, ni = 0;
+        auto next = [&]() {
+            if (ni >= nodes.size() || (li < leaves.size() && leaves[li]->freq <= nodes[ni]->freq))
+                return leaves[li++];
+            return nodes[ni++];
+        };
+        while ((leaves.size() - li) + (nodes.size() - ni) > 1) {
+            Node * r = next();
+            Node * l = next();
             nodes.push_back(new Node(l, r));
         }
-        ftree = std::move(std::unique_ptr<Node>(nodes.front()));
+        ftree = std::move(std::unique_ptr<Node>(nodes.empty() ? leaves.front() : nodes.back()));
         reload_codes();
+        if (maxlen != 0) {
+            for (unsigned int s : alphabet) {
+                if (codes[s].length > maxlen) {
+                    limit(folded, maxlen);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Create a frequency tree
+    void create(const void * data, std::size_t count, unsigned int elem_size = N, unsigned int maxlen = 0) {
+        std::array<unsigned int, 1 << N> freqs;
+        histogram(data, count, freqs, elem_size);
+        create(freqs, elem_size, maxlen);
     }
 
     // Console output displaying
     void display() {
         std::cout << "Value\tFrequency\tCode" << std::endl << std::endl;
-        std::vector<bool> bv;
-        ftree->display(bv);
+        std::string code;
+        ftree->display(code);
     }
 
     // Write frequency tree
-    unsigned int write(std::vector<bool>& stream, unsigned int elem_size = N) {
+    unsigned int write(BitWriter& stream, unsigned int elem_size = N) {
         unsigned int sz = stream.size();
         ftree->write(stream, elem_size);
         return stream.size() - sz;
     }
 
+    // Write code lengths, densely or only for the coded symbols (canonical codes replace the frequency tree ones)
+    unsigned int write_lengths(BitWriter& stream, unsigned int elem_size = N) {
+        unsigned int sz = stream.size(), maxlen = 0, bits = 0;
+        canonize();
+        for (unsigned int s : alphabet)
+            maxlen = std::max(maxlen, codes[s].length);
+        while ((maxlen >> bits) != 0)
+            bits++;
+        stream.write(bits, 3);
+        if (bits == 0)
+            stream.write(alphabet.front(), elem_size);
+        else {
+            bool sparse = (1u << elem_size) + alphabet.size() * bits < (1u << elem_size) * bits;
+            stream.write(sparse);
+            for (unsigned int s = 0; s < (1u << elem_size); s++) {
+                if (sparse)
+                    stream.write(codes[s].length != 0);
+                if (!sparse || codes[s].length != 0)
+                    stream.write(codes[s].length, bits);
+            }
+        }
+        return stream.size() - sz;
+    }
+
+    // Size in bits of the data content of given elements counts (without writing it)
+    std::size_t cost(const std::array<unsigned int, 1 << N>& freqs, unsigned int elem_size = N) const {
+        std::size_t bits = 0;
+        for (unsigned int i = 0; i < (1 << N); i++)
+            bits += (std::size_t)freqs[i] * codes[i & ((1 << elem_size) - 1)].length;
+        return bits;
+    }
+
     // Write data content with frequency tree
-    unsigned int write(std::vector<bool>& stream, const void * data, std::size_t count, unsigned int elem_size = N) {
+    unsigned int write(BitWriter& stream, const void * data, std::size_t count, unsigned int elem_size = N) {
         unsigned int sz = stream.size();
-        for (unsigned int i = 0; i < count; i++) {
-            std::bitset<N> elem;
-            for (unsigned int j = 0; j < elem_size; j++) {
-                unsigned long nbB = (unsigned long)i * (unsigned long)N + (unsigned long)j;
-                elem[j] = (((unsigned char *)data)[(unsigned int)(nbB / (unsigned long)8)] >> (nbB % 8)) & 0x1;
-            }
-            std::vector<bool>& code = codes[elem.to_ulong()];
-            for (unsigned int i = 0, _sz = code.size(); i < _sz; i++)
-                stream.push_back(code[i]);
+        for (std::size_t i = 0; i < count; i++) {
+            const Code& code = codes[element(data, i, elem_size)];
+            stream.write(code.bits, code.length);
         }
         return stream.size() - sz;
     }
 
     // Read frequency tree
-    unsigned int read(const std::vector<bool>& stream, unsigned int elem_size = N) {
-        unsigned int it = 0;
-        ftree = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, it, elem_size)));
+    unsigned int read(BitReader& stream, unsigned int elem_size = N) {
+        std::size_t it = stream.position();
+        ftree = std::move(std::unique_ptr<Node>(Huffman<N>::Node::read(stream, elem_size)));
         reload_codes();
-        return it;
+        reload_table();
+        return stream.position() - it;
+    }
+
+    // Read code lengths and rebuild canonical codes (and their tree)
+    unsigned int read_lengths(BitReader& stream, unsigned int elem_size = N) {
+        std::size_t it = stream.position();
+        ftree.reset();
+        alphabet.clear();
+        for (unsigned int i = 0; i < (1 << N); i++)
+            codes[i] = Code { 0, 0 };
+        unsigned int bits = stream.read(3);
+        if (bits == 0)
+            alphabet.push_back(stream.read(elem_size));
+        else {
+            bool sparse = stream.bit();
+            for (unsigned int s = 0; s < (1u << elem_size); s++) {
+                if (sparse && !stream.bit())
+                    continue;
+                codes[s].length = stream.read(bits);
+                if (codes[s].length != 0)
+                    alphabet.push_back(s);
+            }
+        }
+        canonize();
+        std::array<unsigned int, 1 << N> freqs;
+        freqs.fill(0);
+        ftree = std::move(std::unique_ptr<Node>(Node::tree(codes, alphabet, freqs)));
+        reload_table();
+        return stream.position() - it;
+    }
+
+    // Read data content with decoding tables
+    unsigned int read(BitReader& stream, void * data, std::size_t count) {
+        std::size_t it = stream.position();
+        for (std::size_t i = 0; i < count; i++) {
+            const Entry * entry = &table[stream.peek(table_bits)];
+            while (entry->link) {
+                stream.skip(entry->length);
+                entry = &table[entry->value + stream.peek(entry->link)];
+            }
+            stream.skip(entry->length);
+            if (N == 8)
+                ((unsigned char *)data)[i] = (unsigned char)entry->value;
+            else {
+                for (unsigned int j = 0; j < N; j++) {
+                    unsigned long nbB = (unsigned long)i * (unsigned long)N + (unsigned long)j;
+                    unsigned int block = (unsigned int)(nbB / (unsigned long)8);
+                    unsigned int bitpos = (nbB % 8);
+                    ((unsigned char *)data)[block] &= ~(0x1 << bitpos);
+                    ((unsigned char *)data)[block] |= (((entry->value >> j) & 0x1) << bitpos);
+                }
+            }
+        }
+        return stream.position() - it;
     }
 
-    // Read data content with frequency tree
-    unsigned int read(const std::vector<bool>& stream, void * data, std::size_t count) {
-        unsigned int it = 0;
-        for (unsigned int i = 0; i < count; i++) {
+    // Read data content walking the frequency tree bit per bit (reference decoder)
+    unsigned int read_walk(BitReader& stream, void * data, std::size_t count) {
+        std::size_t it = stream.position();
+        for (std::size_t i = 0; i < count; i++) {
             std::reference_wrapper<Node> current = *ftree;
             while (!current.get().leave()) {
-                if (stream[it++] == 0)
+                if (!stream.bit())
                     current = *current.get().left;
                 else
                     current = *current.get().right;
@@ -216,7 +493,7 @@ public:
                 ((unsigned char *)data)[block] |= ((current.get().value->operator[](j) ? 0x1 : 0x0) << bitpos);
             }
         }
-        return it;
+        return stream.position() - it;
     }
 
 };
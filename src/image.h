@@ -20,6 +20,9 @@ typedef struct {
     const unsigned char& operator[](unsigned int i) const { return get(i); }
 } PixelRGB;
 
+// The pixels are read as interleaved RGB bytes by the conversions
+static_assert(sizeof(PixelRGB) == 3, "PixelRGB must be 3 packed bytes");
+
 class Image : public Bitmap<PixelRGB> {
 
 protected:
@@ -53,7 +56,7 @@ public:
         if (width() != map.width() || height() != map.height())
             resize(map.width(), map.height());
         for (unsigned int i = 0, h = height(); i < h; i++) {
-            for (unsigned int j = 0, w = height(); j < w; j++) {
+            for (unsigned int j = 0, w = width(); j < w; j++) {
                 at(i, j).r = map[i][j];
             }
         }
@@ -63,7 +66,7 @@ public:
         if (width() != map.width() || height() != map.height())
             resize(map.width(), map.height());
         for (unsigned int i = 0, h = height(); i < h; i++) {
-            for (unsigned int j = 0, w = height(); j < w; j++) {
+            for (unsigned int j = 0, w = width(); j < w; j++) {
                 at(i, j).g = map[i][j];
             }
         }
@@ -73,7 +76,7 @@ public:
         if (width() != map.width() || height() != map.height())
             resize(map.width(), map.height());
         for (unsigned int i = 0, h = height(); i < h; i++) {
-            for (unsigned int j = 0, w = height(); j < w; j++) {
+            for (unsigned int j = 0, w = width(); j < w; j++) {
                 at(i, j).b = map[i][j];
             }
         }
@@ -84,7 +87,7 @@ public:
         if (width() != map.width() || height() != map.height())
             resize(map.width(), map.height());
         for (unsigned int i = 0, h = height(); i < h; i++) {
-            for (unsigned int j = 0, w = height(); j < w; j++) {
+            for (unsigned int j = 0, w = width(); j < w; j++) {
                 at(i, j).r = map[i][j];
             }
         }
@@ -1,27 +1,143 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <vector>
 
 #include "format/image-ppm.h"
 #include "process.h"
 #include "stream.h"
+#include "container.h"
+#include "thread-pool.h"
 
 using namespace LiteScript;
 
-void compress(const char * infile, const char * outfile);
-void decompress(const char * infile, const char * outfile);
+// Compressed stream format version (1 : frequency trees, 2 : canonical code lengths, 3 : bitplanes coders, 4 : symbols coders, 5 : sections table, 6 : tiles, 7 : wavelet subbands, 8 : bitplanes lengths,
+// 9 : integer 5/3 wavelet, 10 : finest wavelet details on 7 bits and approximations on 8 bits)
+const unsigned int VERSION = 10;
+
+// Maximum Huffman code length, bounding the decoding tables
+const unsigned int MAX_CODE_LENGTH = 15;
+
+// Tiles are multiple of this size (the blocks of the bitplanes coders and the chroma subsampling stay aligned)
+const unsigned int TILE_ALIGN = 16;
+
+// Without the -t option, the images of more than LARGE_AREA pixels are coded in tiles of LARGE_TILE pixels (the memory is then bounded by a strip),
+// the others as whole images (AUTO_TILE, beyond the valid sides, stands for this choice)
+const unsigned int LARGE_AREA = 1u << 24, LARGE_TILE = 1024, AUTO_TILE = 0x10000;
+
+// Maximum levels of the wavelet subbands mode
+const unsigned int MAX_LEVELS = 4;
+
+// Effort of the modes decision : the filtered mode is decoded on a row pair out of 4^(MAX_EFFORT - effort)
+const unsigned int MAX_EFFORT = 2;
+
+// Maximum threads count of the -j option
+const unsigned int MAX_THREADS = 256;
+
+// Rectangle of an image (the whole image when its width is null)
+struct Region {
+    unsigned int x, y, width, height;
+};
+
+// Compression options
+struct CompressOptions {
+    unsigned int tile;      // tiles side (0 : whole image, AUTO_TILE : from the image size)
+    unsigned int levels;    // wavelet levels (0 : no subbands)
+    unsigned int effort;    // effort of the modes decision
+};
+
+// Plane coded in its own sections : its NMAX low bits by a symbols coder and its bitplanes from NMAX to N - 1
+struct PlaneCoding {
+    unsigned char plane;
+    Bitmap<unsigned char> * map;    // coded plane (decoded plane, of width x height, for the decoder)
+    unsigned int N, NMAX;
+    unsigned int width, height;
+};
+
+// Coders chosen for the bitplanes from NMAX to N - 1 of a plane, with the streams of the run lengths and raw ones
+struct BitplanesTrial {
+    std::vector<BitWriter> streams;
+    std::vector<unsigned int> sizes, codecs;
+    unsigned int planes;    // mask of the range coded bitplanes
+    unsigned int cost;      // estimated size in bits of the bitplanes stream
+};
+
+void compress(const char * infile, const char * outfile, const CompressOptions& options);
+void decompress(const char * infile, const char * outfile, Region region, unsigned int scale);
 
 int main(int argc, char * argv[]) {
     if (argc < 4) {
-        std::cerr << "usage : " << argv[0] << " -[c|d|p] <input.[pgm|ppm]> <output.[pgm|ppm]>" << std::endl;
+        std::cerr << "usage : " << argv[0] << " -[c|d|p] <input.[pgm|ppm]> <output.[pgm|ppm]> [options]" << std::endl;
         std::cerr << "- c : compress" << std::endl;
+        std::cerr << "  -t <size> : independent tiles of size x size pixels (multiple of " << TILE_ALIGN << ", 0 : whole image)," << std::endl;
+        std::cerr << "    by default " << LARGE_TILE << " above " << (LARGE_AREA >> 20) << "M pixels and whole image below" << std::endl;
+        std::cerr << "  -w <levels> : wavelet subbands on 1 to " << MAX_LEVELS << " levels, decodable at lower scales" << std::endl;
+        std::cerr << "  -e <effort> : effort of the modes decision from 0 (sampled rows) to " << MAX_EFFORT << " (whole image, default)" << std::endl;
         std::cerr << "- d : decompress" << std::endl;
+        std::cerr << "  -r <x> <y> <width> <height> : only the given rectangle" << std::endl;
+        std::cerr << "  --scale 1/<n> : image reduced n times (power of 2 up to " << (1 << MAX_LEVELS) << ")" << std::endl;
+        std::cerr << "- c | d : -j <threads> : threads count (all the cores by default)" << std::endl;
+        return -1;
+    }
+
+    CompressOptions options = { AUTO_TILE, 0, MAX_EFFORT };
+    unsigned int scale = 0, n = 1, threads = 0;
+    Region region = { 0, 0, 0, 0 };
+    for (int i = 4; i < argc; i++) {
+        std::string option(argv[i]);
+        if (option == "-t" && i + 1 < argc)
+            options.tile = (unsigned int)std::atoi(argv[++i]);
+        else if (option == "-w" && i + 1 < argc)
+            options.levels = (unsigned int)std::atoi(argv[++i]);
+        else if (option == "-e" && i + 1 < argc)
+            options.effort = (unsigned int)std::atoi(argv[++i]);
+        else if (option == "-j" && i + 1 < argc)
+            threads = (unsigned int)std::atoi(argv[++i]);
+        else if (option == "--scale" && i + 1 < argc) {
+            std::string ratio(argv[++i]);
+            n = (ratio.compare(0, 2, "1/") == 0) ? (unsigned int)std::atoi(ratio.c_str() + 2) : 0;
+        }
+        else if (option == "-r" && i + 4 < argc) {
+            region.x = (unsigned int)std::atoi(argv[++i]);
+            region.y = (unsigned int)std::atoi(argv[++i]);
+            region.width = (unsigned int)std::atoi(argv[++i]);
+            region.height = (unsigned int)std::atoi(argv[++i]);
+        }
+    }
+    if (options.tile != AUTO_TILE && (options.tile % TILE_ALIGN != 0 || options.tile > 0xFFFF)) {
+        std::cerr << "erreur : Taille de tuile invalide" << std::endl;
+        return -1;
+    }
+    if (options.levels > MAX_LEVELS) {
+        std::cerr << "erreur : Nombre de niveaux invalide" << std::endl;
+        return -1;
+    }
+    if (options.effort > MAX_EFFORT) {
+        std::cerr << "erreur : Effort invalide" << std::endl;
+        return -1;
+    }
+    if (threads > MAX_THREADS) {
+        std::cerr << "erreur : Nombre de threads invalide" << std::endl;
+        return -1;
+    }
+    if (threads)
+        ThreadPool::global().resize(threads);
+    while (scale < MAX_LEVELS && (1u << scale) < n)
+        scale++;
+    if (n != (1u << scale)) {
+        std::cerr << "erreur : Echelle invalide" << std::endl;
         return -1;
     }
 
     if (argv[1][1] == 'c')
-        compress(argv[2], argv[3]);
+        compress(argv[2], argv[3], options);
     else if (argv[1][1] == 'd')
-        decompress(argv[2], argv[3]);
+        decompress(argv[2], argv[3], region, scale);
     else {
         ImagePPM imIn;
         imIn.load(argv[2]);
@@ -49,15 +165,19 @@ int main(int argc, char * argv[]) {
     return 0;
 }
 
-void compressColor(OStreamer& stream, const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B);
-void compressGrayscale(OStreamer& stream, const Bitmap<unsigned char>& map);
+unsigned int compressColor(OStreamer& stream, const Bitmap<PixelRGB>& image, const CompressOptions& options);
+unsigned int compressGrayscale(OStreamer& stream, const Bitmap<unsigned char>& map, const CompressOptions& options);
+void compressTiles(std::ostream& file, OStreamer& stream, ImagePPMReader& reader, const CompressOptions& options, std::array<unsigned int, 4>& modes);
 
-void compress(const char * infile, const char * outfile) {
-    ImagePPM imIn;
-    if (!imIn.load(infile)) {
+void compress(const char * infile, const char * outfile, const CompressOptions& chosen) {
+    ImagePPMReader reader;
+    if (!reader.open(infile)) {
         std::cerr << "erreur : Impossible de lire l'image" << std::endl;
         exit(0);
     }
+    CompressOptions options = chosen;
+    if (options.tile == AUTO_TILE)
+        options.tile = ((unsigned long long)reader.width() * reader.height() > LARGE_AREA) ? LARGE_TILE : 0;
 
     std::ofstream file(outfile, std::ios::binary);
     if (!file.is_open()) {
@@ -66,119 +186,321 @@ void compress(const char * infile, const char * outfile) {
     }
     OStreamer stream(file);
 
-    stream << imIn.width() << imIn.height();
-    if (imIn.colored()) {
-        stream << (char)1;
-        compressColor(stream, imIn.getRed(), imIn.getGreen(), imIn.getBlue());
-    }
+    stream << reader.width() << reader.height();
+    stream << (char)((reader.colored() ? 1 : 0) | ((VERSION - 1) << 1));
+    stream << (unsigned short)options.tile;
+    std::array<unsigned int, 4> modes = {{ 0, 0, 0, 0 }};
+    if (options.tile)
+        compressTiles(file, stream, reader, options, modes);
     else {
-        stream << (char)0;
-        compressGrayscale(stream, imIn.getGrayscale());
+        // The sections hold whole planes, the image is read at once
+        ImagePPM imIn;
+        if (!reader.read(imIn, reader.height())) {
+            std::cerr << "erreur : Impossible de lire l'image" << std::endl;
+            exit(0);
+        }
+        if (imIn.colored())
+            modes[compressColor(stream, imIn, options)]++;
+        else
+            modes[compressGrayscale(stream, imIn.getGrayscale(), options)]++;
     }
 
     file.close();
+
+    // Chosen modes (with the tiles count for each)
+    const char * const names[2][3] = { { "6 bits", "7 bits", "wavelet" }, { "filtered", "merged", "wavelet" } };
+    std::cout << "mode :";
+    for (unsigned int m = 1; m < 4; m++) {
+        if (modes[m])
+            std::cout << " " << names[reader.colored() ? 1 : 0][m - 1] << " x " << modes[m];
+    }
+    std::cout << std::endl;
 }
 
-void saveBitvector(OStreamer& stream, std::vector<bool>& bitvector);
-
-void compressColor(OStreamer& stream, const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B) {
-    Bitmap<unsigned char> YQ, YMeanQ, YDiffQ, YDiffQ2, CrQ, CbQ, R2, G2, B2;
-    Bitmap<float> Y, Y2, YMean, YDiff, Cr, Cr2, Cb, Cb2;
-    std::vector<bool> bitvector;
-
-    Process::toYCrCb(R, G, B, Y, Cr, Cb);
-    Process::filterMean(Y, YMean);
-    Process::filterSub(Y, YDiff);
-    Process::Quantify(YMean, YMeanQ, 7);
-    Process::LogQuantify(YDiff, YDiffQ, 6);
-    Process::ReduceQuantify(YDiffQ, YDiffQ, 2);
-    Process::Reduce2(Cr, Cr2);
-    Process::Reduce2(Cb, Cb2);
-    Process::Quantify(Cr2, CrQ, 7);
-    Process::Quantify(Cb2, CbQ, 7);
-    
-    Process::Unquantify(CrQ, Cr2, 7);
-    Process::Unquantify(CbQ, Cb2, 7);
-    Process::Enlarge2(Cr2, Cr);
-    Process::Enlarge2(Cb2, Cb);
-    Process::EnlargeQuantify(YDiffQ, YDiffQ2, 2);
-    Process::LogUnquantify(YDiffQ2, YDiff, 6);
-    Process::Unquantify(YMeanQ, YMean, 7);
-    Process::invertFilter(YMean, YDiff, Y2);
-    Process::toRGB(Y2, Cr, Cb, R2, G2, B2);
-    Process::toGrayscale(R2, G2, B2, YDiffQ2);
-    YQ = Y;
+void encodePlanes(Container& sections, const std::vector<PlaneCoding>& planes);
+unsigned int encodeSymbols(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram);
+unsigned int encodeBitplanes(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX);
+void trialBitplanes(const Bitmap<unsigned char>& in, BitplanesTrial& trial, unsigned int N, unsigned int NMAX);
+unsigned int encodeBitplanes(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX, const BitplanesTrial& trial);
+void compressWavelet(OStreamer& stream, const Bitmap<float> * planes, const unsigned char * ids, unsigned int count, unsigned int width, unsigned int height, unsigned int levels);
+float filteredPSNR(const Bitmap<unsigned char>& YQ, const Bitmap<unsigned char>& YMeanQ, const Bitmap<unsigned char>& YDiffQ, const Bitmap<unsigned char>& CrQ, const Bitmap<unsigned char>& CbQ, unsigned int effort);
+
+unsigned int compressColor(OStreamer& stream, const Bitmap<PixelRGB>& image, const CompressOptions& options) {
+    Bitmap<unsigned char> YQ, YMeanQ, YDiffQ, CrQ, CbQ;
+    Container sections;
+    unsigned int levels = options.levels;
+    const unsigned char * rgb = (const unsigned char *)image.data();
+
+    if (levels) {
+        stream << (unsigned char)3;
+        Bitmap<float> planes[3], Cr, Cb;
+        const unsigned char ids[3] = { Y_PLANE, CR_PLANE, CB_PLANE };
+        Process::toYCrCb(rgb, image.width(), image.height(), planes[0], Cr, Cb);
+        Process::Reduce2(Cr, planes[1]);
+        Process::Reduce2(Cb, planes[2]);
+        compressWavelet(stream, planes, ids, 3, image.width(), image.height(), levels);
+        return 3;
+    }
+    // The planes of the filtered mode come from a single pass over the pixels (the float planes are never stored)
+    Process::filteredPlanes(rgb, image.width(), image.height(), YQ, YMeanQ, YDiffQ, CrQ, CbQ);
+    unsigned int mode = (filteredPSNR(YQ, YMeanQ, YDiffQ, CrQ, CbQ, options.effort) >= 35.0f) ? 1 : 2;
 
     Process::grayCoding(CrQ, CrQ);
     Process::grayCoding(CbQ, CbQ);
-    if (Process::calculatePSNR(YQ, YDiffQ2) >= 35.0f) {
+    if (mode == 1) {
         stream << (unsigned char)1;
         Process::grayCoding(YMeanQ, YMeanQ);
-        Process::huffman(YMeanQ, bitvector, 3);
-        Process::arithmeticEncoding(YMeanQ, bitvector, 7, 3, 16);
-        Process::huffman(YDiffQ, bitvector, 4);
+        encodePlanes(sections, {
+            { Y_PLANE, &YMeanQ, 7, 3 }, { YDIFF_PLANE, &YDiffQ, 4, 4 }, { CR_PLANE, &CrQ, 7, 2 }, { CB_PLANE, &CbQ, 7, 2 }
+        });
     }
     else {
         stream << (unsigned char)2;
-        Process::mergeGrayscale(YQ, YMeanQ, 64);
-        Y = YMeanQ;
-        Process::Quantify(Y, YMeanQ, 6);
-        Process::huffman(YMeanQ, bitvector, 3);
-        Process::arithmeticEncoding(YMeanQ, bitvector, 6, 3, 16);
+        // The levels are merged and quantified on 6 bits at once by a table
+        std::array<unsigned int, 256> histo;
+        Process::histogram(YQ, histo);
+        std::array<unsigned char, 256> table = Process::paletteTable(Process::grayPalette(histo, 64));
+        for (unsigned char& level : table)
+            level >>= 2;
+        Process::applyTable(YQ, YMeanQ, table);
+        encodePlanes(sections, { { Y_PLANE, &YMeanQ, 6, 3 }, { CR_PLANE, &CrQ, 7, 2 }, { CB_PLANE, &CbQ, 7, 2 } });
+    }
+    sections.write(stream);
+    return mode;
+}
+
+// Rows of a bitmap by groups of count rows out of step
+template <typename T>
+void sampleRows(const Bitmap<T>& in, Bitmap<T>& out, unsigned int count, unsigned int step) {
+    unsigned int width = in.width(), height = in.height(), rows = 0;
+    for (unsigned int i = 0; i < height; i += step)
+        rows += std::min(count, height - i);
+    out.resize(width, rows, 0, 0, false);
+    for (unsigned int i = 0, k = 0; i < height; i += step) {
+        for (unsigned int r = i; r < std::min(i + count, height); r++, k++) {
+            for (unsigned int j = 0; j < width; j++)
+                out[k][j] = in[r][j];
+        }
     }
+}
+
+// PSNR of the luminance decoded by the filtered mode. Below the maximum effort, only a row pair out of 4^(MAX_EFFORT - effort)
+// is decoded : the pipeline only mixes the rows of a pair (and the chroma row of the pair), so these rows decode as in the whole image
+float filteredPSNR(const Bitmap<unsigned char>& YQ, const Bitmap<unsigned char>& YMeanQ, const Bitmap<unsigned char>& YDiffQ, const Bitmap<unsigned char>& CrQ, const Bitmap<unsigned char>& CbQ, unsigned int effort) {
+    unsigned int pairs = 1u << (2 * (MAX_EFFORT - effort));
+    Bitmap<unsigned char> Y1, MeanQ, DiffQ, DiffQ2, Cr3, Cb3, R2, G2, B2;
+    Bitmap<float> Y2, YMean, YDiff, Cr, Cr2, Cb, Cb2;
+    sampleRows(YQ, Y1, 2, 2 * pairs);
+    sampleRows(YMeanQ, MeanQ, 2, 2 * pairs);
+    sampleRows(YDiffQ, DiffQ, 2, 2 * pairs);
+    sampleRows(CrQ, Cr3, 1, pairs);
+    sampleRows(CbQ, Cb3, 1, pairs);
 
-    Process::huffman(CrQ, bitvector, 2);
-    Process::arithmeticEncoding(CrQ, bitvector, 7, 2, 16);
-    Process::huffman(CbQ, bitvector, 2);
-    Process::arithmeticEncoding(CbQ, bitvector, 7, 2, 16);
-    saveBitvector(stream, bitvector);
+    Process::Unquantify(Cr3, Cr2, 7);
+    Process::Unquantify(Cb3, Cb2, 7);
+    Process::Enlarge2(Cr2, Cr);
+    Process::Enlarge2(Cb2, Cb);
+    Process::EnlargeQuantify(DiffQ, DiffQ2, 2);
+    Process::LogUnquantify(DiffQ2, YDiff, 6);
+    Process::Unquantify(MeanQ, YMean, 7);
+    Process::invertFilter(YMean, YDiff, Y2);
+    Process::toRGB(Y2, Cr, Cb, R2, G2, B2);
+    Process::toGrayscale(R2, G2, B2, DiffQ2);
+    return Process::calculatePSNR(Y1, DiffQ2);
 }
 
-void compressGrayscale(OStreamer& stream, const Bitmap<unsigned char>& map) {
-    Bitmap<float> Y;
+unsigned int compressGrayscale(OStreamer& stream, const Bitmap<unsigned char>& map, const CompressOptions& options) {
     Bitmap<unsigned char> YQ;
-    Process::mergeGrayscale(map, YQ, 64);
-    Y = YQ;
-    Process::Quantify(Y, YQ, 6);
-    if (Process::calculatePSNR(map, YQ) > 20.0f) {
+    if (options.levels) {
+        stream << (unsigned char)3;
+        const unsigned char id = Y_PLANE;
+        Bitmap<float> Y;
+        Y = map;
+        compressWavelet(stream, &Y, &id, 1, map.width(), map.height(), options.levels);
+        return 3;
+    }
+    // Each value is merged and quantified alike : the coded plane is a table of the image, and the PSNR follows from the histogram
+    std::array<unsigned int, 256> histo;
+    Process::histogram(map, histo);
+    std::array<unsigned char, 256> merged = Process::paletteTable(Process::grayPalette(histo, 64)), table;
+    for (unsigned int v = 0; v < 256; v++)
+        table[v] = merged[v] >> 2;
+    unsigned int mode = (Process::calculatePSNR(histo, table) > 20.0f) ? 1 : 2, N = 6;
+    if (mode == 2) {
+        for (unsigned int v = 0; v < 256; v++)
+            table[v] = merged[v] >> 1;
+        N = 7;
+    }
+    Process::applyTable(map, YQ, table);
+    stream << (unsigned char)mode;
+    // Split coding (symbols of the low half, then bitplanes) or symbols only : the symbols of both codings are estimated from the histogram,
+    // the bitplanes from the trial of their coders, and only the winner is encoded
+    Container sections;
+    BitWriter symbols, bitplanes;
+    BitplanesTrial trial;
+    unsigned int NMAX = N / 2 + N % 2;
+    Process::histogram(YQ, histo);
+    trialBitplanes(YQ, trial, N, NMAX);
+    if (Process::symbolsCost(histo, NMAX, MAX_CODE_LENGTH) + trial.cost < Process::symbolsCost(histo, N, MAX_CODE_LENGTH)) {
         stream << (unsigned char)1;
-        std::vector<bool> bitvector1, bitvector2;
-        unsigned int C1, C2;
-        C1 = Process::huffman(YQ, bitvector1, 3);
-        C1 += Process::arithmeticEncoding(YQ, bitvector1, 6, 3, 16);
-        C2 = Process::huffman(YQ, bitvector2, 6);
-        if (C1 < C2) {
-            stream << (unsigned char)1;
-            saveBitvector(stream, bitvector1);
-        }
-        else {
-            stream << (unsigned char)2;
-            saveBitvector(stream, bitvector2);
-        }
+        encodeSymbols(YQ, symbols, NMAX, histo);
+        encodeBitplanes(YQ, bitplanes, N, NMAX, trial);
+        sections.add(Y_PLANE, SYMBOLS_SECTION, symbols);
+        sections.add(Y_PLANE, BITPLANES_SECTION, bitplanes);
     }
     else {
-        Process::Quantify(Y, YQ, 7);
         stream << (unsigned char)2;
-        std::vector<bool> bitvector1, bitvector2;
-        unsigned int C1, C2;
-        C1 = Process::huffman(YQ, bitvector1, 4);
-        C1 += Process::arithmeticEncoding(YQ, bitvector1, 7, 4, 16);
-        C2 = Process::huffman(YQ, bitvector2, 7);
-        if (C1 < C2) {
-            stream << (unsigned char)1;
-            saveBitvector(stream, bitvector1);
+        encodeSymbols(YQ, symbols, N, histo);
+        sections.add(Y_PLANE, SYMBOLS_SECTION, symbols);
+    }
+    sections.write(stream);
+    return mode;
+}
+
+// Planes extended to a multiple of 2^(levels + 1) (the chroma planes to half of it)
+void waveletSize(unsigned int width, unsigned int height, unsigned int levels, bool chroma, unsigned int& w, unsigned int& h) {
+    unsigned int align = 1u << (levels + 1);
+    w = (width + align - 1) / align * align;
+    h = (height + align - 1) / align * align;
+    if (chroma) {
+        w /= 2;
+        h /= 2;
+    }
+}
+
+// Level of a subband (the approximation, then the details from the coarsest level)
+inline unsigned int bandLevel(unsigned int levels, unsigned int band) {
+    return (band == 0) ? levels : levels - (band - 1) / 3;
+}
+
+// Subband of the finest details, logarithmic on 4 bits before the version 10 (their few steps lost most of the textures,
+// for hardly fewer bytes than the 7 bits of the other subbands)
+inline bool logBand(unsigned int version, unsigned int levels, unsigned int band) {
+    return version < 10 && band != 0 && bandLevel(levels, band) == 1;
+}
+
+// Bits of a subband : the approximations on 8 bits since the version 10 (their overshoots at the sharp edges were clamped to the pixels)
+inline unsigned int bandBits(unsigned int version, unsigned int levels, unsigned int band) {
+    return logBand(version, levels, band) ? 4 : (band == 0 && version >= 10) ? 8 : 7;
+}
+
+// Offset of a subband in the coefficients of its level of width x height (details below, right and below right)
+inline void bandOffset(unsigned int band, unsigned int width, unsigned int height, unsigned int& x, unsigned int& y) {
+    x = (band == 0 || (band - 1) % 3 == 0) ? 0 : width;
+    y = (band == 0 || (band - 1) % 3 == 1) ? 0 : height;
+}
+
+// Quantified subbands of a plane, with steps of 2 : the approximations of the integer 5/3 wavelet (in the range of the pixels but
+// for the overshoots at the sharp edges) are halved above -128 on 8 bits, its details (about twice the mean differences) halved
+// around 128 on 7 bits
+void waveletBands(const Bitmap<float>& in, unsigned int width, unsigned int height, unsigned int levels, Bitmap<unsigned char> * bands) {
+    Bitmap<float> plane, band;
+    Process::Extend(in, plane, width, height);
+    Bitmap<int> coefs(width, height);
+    for (std::size_t k = 0, size = (std::size_t)width * height; k < size; k++)
+        coefs.data()[k] = (int)std::lround(plane.data()[k]);
+    Process::liftingTransform(coefs, levels);
+    for (unsigned int b = 0; b < 1 + 3 * levels; b++) {
+        unsigned int level = bandLevel(levels, b), w = width >> level, h = height >> level, x, y;
+        bandOffset(b, w, h, x, y);
+        band.resize(w, h);
+        for (unsigned int i = 0; i < h; i++) {
+            for (unsigned int j = 0; j < w; j++) {
+                int c = coefs[y + i][x + j];
+                band[i][j] = (b == 0) ? std::min(255.0f, std::max(0.0f, c * 0.5f + 64.0f)) : std::min(254.0f, std::max(1.0f, c * 0.5f + 128.0f));
+            }
         }
-        else {
-            stream << (unsigned char)2;
-            saveBitvector(stream, bitvector2);
+        Process::Quantify(band, bands[b], bandBits(VERSION, levels, b));
+        Process::grayCoding(bands[b], bands[b]);
+    }
+}
+
+// Wavelet subbands mode : each subband is a section, stored from the coarsest (the bands of all the planes for a level before the next level),
+// so that a reduced image only needs the beginning of the sections content
+void compressWavelet(OStreamer& stream, const Bitmap<float> * planes, const unsigned char * ids, unsigned int count, unsigned int width, unsigned int height, unsigned int levels) {
+    unsigned int n = 1 + 3 * levels;
+    std::vector<Bitmap<unsigned char>> bands(count * n);
+    std::vector<PlaneCoding> coded;
+    Container sections;
+    ThreadPool::global().parallelFor(count, [&](unsigned int c) {
+        unsigned int w, h;
+        waveletSize(width, height, levels, ids[c] != Y_PLANE, w, h);
+        waveletBands(planes[c], w, h, levels, &bands[c * n]);
+    });
+    for (unsigned int b = 0; b < n; b++) {
+        for (unsigned int c = 0; c < count; c++) {
+            unsigned int N = bandBits(VERSION, levels, b);
+            PlaneCoding band = { bandPlane(ids[c], b), &bands[c * n + b], N, N / 2 };
+            coded.push_back(band);
+        }
+    }
+    encodePlanes(sections, coded);
+    stream << (unsigned char)levels;
+    sections.write(stream);
+}
+
+// Tiles are coded as whole images in raster order, after an index giving the offset (from the end of the index) and the length in bytes of each tile.
+// The image is read a strip of tiles at a time, each strip is written once coded and the index is filled at the end (the memory is bounded by a strip)
+void compressTiles(std::ostream& file, OStreamer& stream, ImagePPMReader& reader, const CompressOptions& options, std::array<unsigned int, 4>& modes) {
+    unsigned int tile = options.tile, width = reader.width(), height = reader.height(),
+                 columns = (width + tile - 1) / tile, rows = (height + tile - 1) / tile;
+    bool colored = reader.colored();
+    std::vector<unsigned int> offsets(columns * rows), lengths(columns * rows);
+    std::streampos index = file.tellp();
+    for (unsigned int t = 0; t < columns * rows; t++)
+        stream << offsets[t] << lengths[t];
+    unsigned int offset = 0;
+    for (unsigned int row = 0; row < rows; row++) {
+        ImagePPM strip;
+        if (!reader.read(strip, tile)) {
+            std::cerr << "erreur : Impossible de lire l'image" << std::endl;
+            exit(0);
+        }
+        Bitmap<unsigned char> R;
+        if (!colored)
+            R = strip.getGrayscale();
+        std::vector<std::string> tiles(columns);
+        std::vector<unsigned int> chosen(columns);
+        ThreadPool::global().parallelFor(columns, [&](unsigned int t) {
+            unsigned int x = t * tile, w = std::min(tile, width - x), h = strip.height();
+            std::ostringstream bytes;
+            OStreamer out(bytes);
+            if (colored) {
+                Bitmap<PixelRGB> pixels;
+                strip.copy(pixels, w, h, x, 0);
+                chosen[t] = compressColor(out, pixels, options);
+            }
+            else {
+                Bitmap<unsigned char> r;
+                R.copy(r, w, h, x, 0);
+                chosen[t] = compressGrayscale(out, r, options);
+            }
+            tiles[t] = bytes.str();
+        });
+        for (unsigned int t = 0; t < columns; t++) {
+            offsets[row * columns + t] = offset;
+            lengths[row * columns + t] = (unsigned int)tiles[t].size();
+            offset += (unsigned int)tiles[t].size();
+            stream.write(tiles[t].data(), tiles[t].size());
+            modes[chosen[t]]++;
         }
     }
+    file.seekp(index);
+    for (unsigned int t = 0; t < columns * rows; t++)
+        stream << offsets[t] << lengths[t];
+    file.seekp(0, std::ios::end);
 }
 
-void decompressColor(IStreamer& stream, unsigned int width, unsigned int height, Bitmap<unsigned char>& R, Bitmap<unsigned char>& G, Bitmap<unsigned char>& B);
-void decompressGrayscale(IStreamer& stream, unsigned int width, unsigned int height, Bitmap<unsigned char>& map);
+void decompressColor(IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int scale, Image& pixels);
+void decompressGrayscale(IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int scale, Bitmap<unsigned char>& map);
+void decompressTiles(std::istream& file, IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int tile, bool colored, const Region& region, unsigned int scale, Bitmap<unsigned char>& map, Image& pixels);
 
-void decompress(const char * infile, const char * outfile) {
+// Side of a reduced image of 2^scale times
+inline unsigned int scaled(unsigned int size, unsigned int scale) {
+    return (size + (1u << scale) - 1) >> scale;
+}
+
+void decompress(const char * infile, const char * outfile, Region region, unsigned int scale) {
     std::ifstream file(infile, std::ios::binary);
     if (!file.is_open()) {
         std::cerr << "erreur : Impossible de lire l'image compresse" << std::endl;
@@ -190,20 +512,57 @@ void decompress(const char * infile, const char * outfile) {
     unsigned int width, height;
     stream >> width;
     stream >> height;
-    char color;
-    stream >> color;
-    if (color == 1) {
-        Bitmap<unsigned char> R, G, B;
-        decompressColor(stream, width, height, R, G, B);
-        imOut.setRed(R);
-        imOut.setGreen(G);
-        imOut.setBlue(B);
+    unsigned char flags;
+    stream >> flags;
+    unsigned int version = (flags >> 1) + 1;
+    if (version > VERSION) {
+        std::cerr << "erreur : Version " << version << " du format non supportee" << std::endl;
+        exit(0);
+    }
+    unsigned short tile = 0;
+    if (version >= 6)
+        stream >> tile;
+    if (region.width == 0 || region.height == 0) {
+        region.x = 0;
+        region.y = 0;
+        region.width = width;
+        region.height = height;
+    }
+    if (region.x >= width || region.y >= height) {
+        std::cerr << "erreur : Region en dehors de l'image" << std::endl;
+        exit(0);
+    }
+    region.width = std::min(region.width, width - region.x);
+    region.height = std::min(region.height, height - region.y);
+    // The region is given on the whole image, the decoded rectangle is at the scale
+    Region part = { region.x >> scale, region.y >> scale, 0, 0 };
+    part.width = scaled(region.x + region.width, scale) - part.x;
+    part.height = scaled(region.y + region.height, scale) - part.y;
+
+    // The colour planes are decoded straight to the pixels of the image
+    Bitmap<unsigned char> map;
+    if (tile)
+        decompressTiles(file, stream, version, width, height, tile, (flags & 0x1) != 0, part, scale, map, imOut);
+    else if (flags & 0x1) {
+        decompressColor(stream, version, width, height, scale, imOut);
+        if (part.width < imOut.width() || part.height < imOut.height()) {
+            ImagePPM crop;
+            imOut.copy(crop, part.width, part.height, part.x, part.y);
+            imOut = crop;
+        }
     }
     else {
-        Bitmap<unsigned char> map;
-        decompressGrayscale(stream, width, height, map);
-        imOut = map;
+        decompressGrayscale(stream, version, width, height, scale, map);
+        if (part.width < map.width() || part.height < map.height()) {
+            Bitmap<unsigned char> crop;
+            map.copy(crop, part.width, part.height, part.x, part.y);
+            map = crop;
+        }
     }
+    if (flags & 0x1)
+        imOut.colorize();
+    else
+        imOut = map;
     file.close();
 
     if (!imOut.save(outfile)) {
@@ -212,94 +571,434 @@ void decompress(const char * infile, const char * outfile) {
     }
 }
 
-void loadBitvector(IStreamer& stream, std::vector<bool>& bitvector);
+// Copy the part of a tile at (x, y) inside the region
+template <typename T>
+void pasteTile(const Bitmap<T>& in, unsigned int x, unsigned int y, const Region& region, Bitmap<T>& out) {
+    unsigned int i0 = std::max(y, region.y), i1 = std::min(y + in.height(), region.y + region.height),
+                 j0 = std::max(x, region.x), j1 = std::min(x + in.width(), region.x + region.width);
+    for (unsigned int i = i0; i < i1; i++) {
+        for (unsigned int j = j0; j < j1; j++)
+            out.at(i - region.y, j - region.x) = in.at(i - y, j - x);
+    }
+}
+
+// Only the tiles covering the region (at the scale) are read from the file and decoded
+void decompressTiles(std::istream& file, IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int tile, bool colored, const Region& region, unsigned int scale, Bitmap<unsigned char>& map, Image& pixels) {
+    unsigned int columns = (width + tile - 1) / tile, rows = (height + tile - 1) / tile, side = tile >> scale;
+    std::vector<unsigned int> offsets(columns * rows), lengths(columns * rows);
+    for (unsigned int t = 0; t < columns * rows; t++)
+        stream >> offsets[t] >> lengths[t];
+    std::streamoff base = file.tellg();
+    std::vector<unsigned int> covering;
+    for (unsigned int i = region.y / side; i * side < region.y + region.height; i++) {
+        for (unsigned int j = region.x / side; j * side < region.x + region.width; j++)
+            covering.push_back(i * columns + j);
+    }
+    std::vector<std::string> tiles(covering.size());
+    for (std::size_t k = 0; k < covering.size(); k++) {
+        file.clear();
+        file.seekg(base + (std::streamoff)offsets[covering[k]]);
+        tiles[k].resize(lengths[covering[k]]);
+        file.read(&tiles[k][0], lengths[covering[k]]);
+        tiles[k].resize((std::size_t)file.gcount());
+    }
+    if (colored) {
+        const PixelRGB black = { 0, 0, 0 };
+        pixels.resize(region.width, region.height, 0, 0, false);
+        std::fill(pixels.data(), pixels.data() + region.width * region.height, black);
+    }
+    else {
+        map.resize(region.width, region.height, 0, 0, false);
+        std::fill(map.data(), map.data() + region.width * region.height, 0);
+    }
+    ThreadPool::global().parallelFor((unsigned int)covering.size(), [&](unsigned int k) {
+        unsigned int t = covering[k], x = (t % columns) * tile, y = (t / columns) * tile,
+                     w = std::min(tile, width - x), h = std::min(tile, height - y);
+        std::istringstream bytes(tiles[k]);
+        IStreamer in(bytes);
+        if (colored) {
+            Image part;
+            decompressColor(in, version, w, h, scale, part);
+            pasteTile<PixelRGB>(part, x >> scale, y >> scale, region, pixels);
+        }
+        else {
+            Bitmap<unsigned char> part;
+            decompressGrayscale(in, version, w, h, scale, part);
+            pasteTile(part, x >> scale, y >> scale, region, map);
+        }
+    });
+}
 
-void decompressColor(IStreamer& stream, unsigned int width, unsigned int height, Bitmap<unsigned char>& R, Bitmap<unsigned char>& G, Bitmap<unsigned char>& B) {
-    Bitmap<unsigned char> YQ, Cr3, Cb3, YMeanQ, YDiffQ, YDiffQ2;
-    Bitmap<float> Y, YMean, YDiff, Cr, Cr2, Cb, Cb2;
-    std::vector<bool> bitvector;
+void loadSections(IStreamer& stream, unsigned int version, Container& sections);
+void decodePlanes(Container& sections, const std::vector<PlaneCoding>& planes, unsigned int version);
+unsigned int decompressWavelet(IStreamer& stream, unsigned int version, Bitmap<float> * planes, const unsigned char * ids, unsigned int count, unsigned int width, unsigned int height, unsigned int scale);
+void reducePlane(Bitmap<unsigned char>& map, unsigned int scale);
+void reducePixels(Image& pixels, unsigned int scale);
+
+void decompressColor(IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int scale, Image& pixels) {
+    Bitmap<unsigned char> YQ, Cr3, Cb3, YMeanQ, YDiffQ;
+    Container sections;
     unsigned char c;
     stream >> c;
-    loadBitvector(stream, bitvector);
+    if (c == 3) {
+        Bitmap<float> planes[3], Cr, Cb;
+        const unsigned char ids[3] = { Y_PLANE, CR_PLANE, CB_PLANE };
+        unsigned int reached = decompressWavelet(stream, version, planes, ids, 3, width, height, scale);
+        Process::Enlarge2(planes[1], Cr);
+        Process::Enlarge2(planes[2], Cb);
+        Image padded(planes[0].width(), planes[0].height());
+        Process::toRGB(planes[0], Cr, Cb, (unsigned char *)padded.data());
+        padded.copy(pixels, scaled(width, reached), scaled(height, reached));
+        reducePixels(pixels, scale - reached);
+        return;
+    }
+    loadSections(stream, version, sections);
     if (c == 1) {
-        bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YMeanQ, width / 2, height, 3));
-        bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, YMeanQ, width / 2, height, 7, 3, 16));
-        bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YDiffQ, width / 2, height, 4));
+        decodePlanes(sections, {
+            { Y_PLANE, &YMeanQ, 7, 3, width / 2, height }, { YDIFF_PLANE, &YDiffQ, 4, 4, width / 2, height },
+            { CR_PLANE, &Cr3, 7, 2, width / 2, height / 2 }, { CB_PLANE, &Cb3, 7, 2, width / 2, height / 2 }
+        }, version);
         Process::invertGrayCoding(YMeanQ, YMeanQ);
-        Process::Unquantify(YMeanQ, YMean, 7);
-        Process::EnlargeQuantify(YDiffQ, YDiffQ2, 2);
-        Process::LogUnquantify(YDiffQ2, YDiff, 6);
-        Process::invertFilter(YMean, YDiff, Y);
     }
     else {
-        bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YQ, width, height, 3));
-        bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, YQ, width, height, 6, 3, 16));
-        Process::Unquantify(YQ, Y, 6);
-    }
-    bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, Cr3, width / 2, height / 2, 2));
-    bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, Cr3, width / 2, height / 2, 7, 2, 16));
-    bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, Cb3, width / 2, height / 2, 2));
-    bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, Cb3, width / 2, height / 2, 7, 2, 16));
+        decodePlanes(sections, {
+            { Y_PLANE, &YQ, 6, 3, width, height }, { CR_PLANE, &Cr3, 7, 2, width / 2, height / 2 }, { CB_PLANE, &Cb3, 7, 2, width / 2, height / 2 }
+        }, version);
+    }
     Process::invertGrayCoding(Cr3, Cr3);
     Process::invertGrayCoding(Cb3, Cb3);
-    Process::Unquantify(Cr3, Cr2, 7);
-    Process::Unquantify(Cb3, Cb2, 7);
-    Cr2.resize(Y.width() / 2, Y.height() / 2);
-    Cb2.resize(Y.width() / 2, Y.height() / 2);
-    Process::Enlarge2(Cr2, Cr);
-    Process::Enlarge2(Cb2, Cb);
-    Process::toRGB(Y, Cr, Cb, R, G, B);
+    // The filtered mode decodes the pixels pairs only (an odd width loses its last column)
+    if (c == 1) {
+        pixels.resize(YMeanQ.width() * 2, YMeanQ.height(), 0, 0, false);
+        Process::filteredRGB(YMeanQ, YDiffQ, Cr3, Cb3, (unsigned char *)pixels.data());
+    }
+    else {
+        pixels.resize(YQ.width(), YQ.height(), 0, 0, false);
+        Process::mergedRGB(YQ, Cr3, Cb3, (unsigned char *)pixels.data());
+    }
+    reducePixels(pixels, scale);
 }
 
-void decompressGrayscale(IStreamer& stream, unsigned int width, unsigned int height, Bitmap<unsigned char>& map) {
+void decompressGrayscale(IStreamer& stream, unsigned int version, unsigned int width, unsigned int height, unsigned int scale, Bitmap<unsigned char>& map) {
     Bitmap<float> Y;
     Bitmap<unsigned char> YQ;
-    std::vector<bool> bitvector;
+    Container sections;
     unsigned char c1, c2;
     stream >> c1;
+    if (c1 == 3) {
+        const unsigned char id = Y_PLANE;
+        unsigned int reached = decompressWavelet(stream, version, &Y, &id, 1, width, height, scale);
+        YQ = Y;
+        YQ.copy(map, scaled(width, reached), scaled(height, reached));
+        reducePlane(map, scale - reached);
+        return;
+    }
     stream >> c2;
-    loadBitvector(stream, bitvector);
-    if (c1 == 1) {
-        if (c2 == 1) {
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YQ, width, height, 3));
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, YQ, width, height, 6, 3, 16));
+    loadSections(stream, version, sections);
+    // Split coding (c2 = 1) or symbols only
+    unsigned int N = (c1 == 1) ? 6 : 7;
+    decodePlanes(sections, { { Y_PLANE, &YQ, N, (c2 == 1) ? N / 2 + N % 2 : N, width, height } }, version);
+    Process::Unquantify(YQ, Y, N);
+    map = Y;
+    reducePlane(map, scale);
+}
+
+// Plane at 1 / 2^scale from its subbands (only the levels above the scale), through the float Haar wavelet before the version 9
+void invertWaveletBands(Bitmap<unsigned char> * bands, unsigned int version, unsigned int width, unsigned int height, unsigned int levels, unsigned int scale, Bitmap<float>& out) {
+    bool lifting = version >= 9;
+    Bitmap<float> coefs(width >> scale, height >> scale), band;
+    Bitmap<int> values(lifting ? width >> scale : 0, lifting ? height >> scale : 0);
+    Bitmap<unsigned char> q;
+    for (unsigned int b = 0; b < 1 + 3 * (levels - scale); b++) {
+        unsigned int level = bandLevel(levels, b), x, y;
+        bandOffset(b, width >> level, height >> level, x, y);
+        bool logarithmic = logBand(version, levels, b);
+        unsigned int N = bandBits(version, levels, b);
+        if (!logarithmic) {
+            Process::invertGrayCoding(bands[b], q);
+            Process::Unquantify(q, band, N);
         }
         else {
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YQ, width, height, 6));
+            Process::EnlargeQuantify(bands[b], q, 2);
+            Process::LogUnquantify(q, band, 6);
         }
-        Process::Unquantify(YQ, Y, 6);
-    }
-    else {
-        if (c2 == 1) {
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YQ, width, height, 4));
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertArithmeticEncoding(bitvector, YQ, width, height, 7, 4, 16));
+        if (!lifting) {
+            coefs.fill(band, x, y);
+            continue;
         }
-        else {
-            bitvector.erase(bitvector.begin(), bitvector.begin() + Process::invertHuffman(bitvector, YQ, width, height, 7));
+        // The integer coefficients at the middle of the steps (the logarithmic steps are already at their middle), the details
+        // back around 0 at their scale, the approximations on 8 bits back above -128
+        float middle = logarithmic ? 0.0f : (float)(256 >> N) * 0.5f, centre = (b == 0) ? 64.0f : 128.0f;
+        for (unsigned int i = 0, h = band.height(); i < h; i++) {
+            for (unsigned int j = 0, w = band.width(); j < w; j++) {
+                float c = band[i][j] + middle;
+                values[y + i][x + j] = (b == 0 && N == 7) ? (int)c : (int)std::lround((c - centre) * 2.0f);
+            }
         }
-        Process::Unquantify(YQ, Y, 7);
     }
-    map = Y;
+    if (lifting) {
+        Process::invertLiftingTransform(values, levels - scale);
+        out.resize(values.width(), values.height());
+        for (std::size_t k = 0, size = (std::size_t)values.width() * values.height(); k < size; k++)
+            out.data()[k] = (float)values.data()[k];
+    }
+    else if (levels > scale)
+        Process::invertWaveletTransform(coefs, out, levels - scale);
+    else
+        out = coefs;
+    // The ringing of the coarse details may leave the range of the pixels (wrapped by the conversion to bytes)
+    for (std::size_t k = 0, size = (std::size_t)out.width() * out.height(); k < size; k++)
+        out.data()[k] = std::min(255.0f, std::max(0.0f, out.data()[k]));
 }
 
-void saveBitvector(OStreamer& stream, std::vector<bool>& bitvector) {
-    unsigned char c = 0;
-    for (unsigned long i = 0, size = bitvector.size(); i < size; i++) {
-        c |= bitvector[i] << (i % 8);
-        if ((i + 1) % 8 == 0) {
-            stream << c;
-            c = 0;
+// Only the sections of the subbands above the scale are read from the stream, the planes are at the scale if the levels reach it (the reached scale is returned)
+unsigned int decompressWavelet(IStreamer& stream, unsigned int version, Bitmap<float> * planes, const unsigned char * ids, unsigned int count, unsigned int width, unsigned int height, unsigned int scale) {
+    unsigned char levels;
+    stream >> levels;
+    if (levels == 0 || levels > MAX_LEVELS) {
+        std::cerr << "erreur : Nombre de niveaux invalide" << std::endl;
+        exit(0);
+    }
+    scale = std::min(scale, (unsigned int)levels);
+    unsigned int n = 1 + 3 * (levels - scale);
+    Container sections;
+    sections.readTable(stream);
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < sections.size(); i++) {
+        if ((unsigned int)(sections[i].plane >> 2) < n)
+            size = std::max(size, (std::size_t)sections[i].offset + sections[i].length);
+    }
+    sections.readContent(stream, size);
+    std::vector<Bitmap<unsigned char>> bands(count * n);
+    std::vector<PlaneCoding> coded;
+    for (unsigned int c = 0; c < count; c++) {
+        unsigned int W, H;
+        waveletSize(width, height, levels, ids[c] != Y_PLANE, W, H);
+        for (unsigned int b = 0; b < n; b++) {
+            unsigned int level = bandLevel(levels, b), N = bandBits(version, levels, b);
+            PlaneCoding band = { bandPlane(ids[c], b), &bands[c * n + b], N, logBand(version, levels, b) ? N : N / 2, W >> level, H >> level };
+            coded.push_back(band);
         }
     }
-    if (bitvector.size() % 8 != 0)
-        stream << c;
+    decodePlanes(sections, coded, version);
+    ThreadPool::global().parallelFor(count, [&](unsigned int c) {
+        unsigned int W, H;
+        waveletSize(width, height, levels, ids[c] != Y_PLANE, W, H);
+        invertWaveletBands(&bands[c * n], version, W, H, levels, scale, planes[c]);
+    });
+    return scale;
 }
 
-void loadBitvector(IStreamer& stream, std::vector<bool>& bitvector) {
-    unsigned char c;
-    for (unsigned long i = 0; !stream.eof(); i++) {
-        if (i % 8 == 0)
-            stream >> c;
-        bitvector.push_back((c >> (i % 8)) & 0x1);
+// Image reduced 2^scale times (modes without subbands, decoded at full scale)
+void reducePlane(Bitmap<unsigned char>& map, unsigned int scale) {
+    if (scale == 0)
+        return;
+    Bitmap<float> planes[2];
+    planes[0] = map;
+    for (unsigned int s = 0; s < scale; s++)
+        Process::Reduce2(planes[s % 2], planes[(s + 1) % 2]);
+    map = planes[scale % 2];
+}
+
+// Each channel is reduced alike
+void reducePixels(Image& pixels, unsigned int scale) {
+    if (scale == 0)
+        return;
+    Bitmap<unsigned char> R, G, B;
+    R = pixels.getRed();
+    G = pixels.getGreen();
+    B = pixels.getBlue();
+    reducePlane(R, scale);
+    reducePlane(G, scale);
+    reducePlane(B, scale);
+    pixels.setRed(R);
+    pixels.setGreen(G);
+    pixels.setBlue(B);
+}
+
+// Streams before the sections table are a single bitvector with the planes one after the other
+void loadSections(IStreamer& stream, unsigned int version, Container& sections) {
+    if (version >= 5)
+        sections.read(stream);
+    else
+        sections.readFlat(stream);
+}
+
+unsigned int encodeSymbols(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram);
+unsigned int encodeBitplanes(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX);
+unsigned int decodeSymbols(BitReader& in, Bitmap<unsigned char>& out, unsigned int version, unsigned int width, unsigned int height, unsigned int N);
+unsigned int decodeBitplanes(BitReader& in, Bitmap<unsigned char>& out, unsigned int version, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX);
+
+// The planes are coded at once on the threads pool, each in its own bits streams, and their sections are added in the planes order
+// (the stream does not depend on the threads count)
+void encodePlanes(Container& sections, const std::vector<PlaneCoding>& planes) {
+    std::vector<BitWriter> symbols(planes.size()), bitplanes(planes.size());
+    ThreadPool::global().parallelFor((unsigned int)planes.size(), [&](unsigned int k) {
+        const PlaneCoding& p = planes[k];
+        std::array<unsigned int, 256> histo;
+        Process::histogram(*p.map, histo);
+        encodeSymbols(*p.map, symbols[k], p.NMAX, histo);
+        if (p.NMAX < p.N)
+            encodeBitplanes(*p.map, bitplanes[k], p.N, p.NMAX);
+    });
+    for (std::size_t k = 0; k < planes.size(); k++) {
+        sections.add(planes[k].plane, SYMBOLS_SECTION, symbols[k]);
+        if (planes[k].NMAX < planes[k].N)
+            sections.add(planes[k].plane, BITPLANES_SECTION, bitplanes[k]);
+    }
+}
+
+// The readers of the sections are opened first, then the planes are decoded at once on the threads pool
+// (one after the other when they share a single section)
+void decodePlanes(Container& sections, const std::vector<PlaneCoding>& planes, unsigned int version) {
+    std::vector<BitReader *> symbols(planes.size()), bitplanes(planes.size());
+    for (std::size_t k = 0; k < planes.size(); k++) {
+        symbols[k] = &sections.open(planes[k].plane, SYMBOLS_SECTION);
+        if (planes[k].NMAX < planes[k].N)
+            bitplanes[k] = &sections.open(planes[k].plane, BITPLANES_SECTION);
+    }
+    auto decode = [&](unsigned int k) {
+        const PlaneCoding& p = planes[k];
+        decodeSymbols(*symbols[k], *p.map, version, p.width, p.height, p.NMAX);
+        if (p.NMAX < p.N)
+            decodeBitplanes(*bitplanes[k], *p.map, version, p.width, p.height, p.N, p.NMAX);
+    };
+    if (sections.shared()) {
+        for (unsigned int k = 0; k < planes.size(); k++)
+            decode(k);
+    }
+    else
+        ThreadPool::global().parallelFor((unsigned int)planes.size(), decode);
+}
+
+// Symbols coders (0 : canonical Huffman codes, 1 : interleaved rANS), the shortest by their estimates from the histogram is the only one coded
+unsigned int encodeSymbols(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram) {
+    bool rans;
+    Process::symbolsCost(histogram, N, MAX_CODE_LENGTH, rans);
+    out.write(rans);
+    return 1 + (rans ? Process::rans(in, out, N, histogram) : Process::huffman(in, out, N, histogram, true, MAX_CODE_LENGTH));
+}
+
+unsigned int decodeSymbols(BitReader& in, Bitmap<unsigned char>& out, unsigned int version, unsigned int width, unsigned int height, unsigned int N) {
+    if (version >= 4 && in.bit())
+        return 1 + Process::invertRans(in, out, width, height, N);
+    return (version >= 4 ? 1 : 0) + Process::invertHuffman(in, out, width, height, N, version >= 2);
+}
+
+// Bitplanes coders, chosen for each bitplane (stored on 2 bits from the most significant bitplane)
+enum BitplaneCodec {
+    RLE_CODEC = 0,      // run lengths by blocks
+    CONTEXT_CODEC = 1,  // context adaptive range coder
+    RAW_CODEC = 2       // bits as they are
+};
+
+// Bits of a bitplane stream length
+const unsigned int LENGTH_BITS = 6;
+
+// Bitplanes of smaller planes (in pixels) are decoded one after the other, without the lengths of their streams
+const unsigned int PARALLEL_AREA = 1 << 16;
+
+// The range coder is kept for a bitplane when it saves a fifth of the fastest coder (it decodes slower by pixel). The coders are tried
+// on all the bitplanes at once, the range coder on an estimate of its size only (it is the slowest, and codes its bitplanes together
+// once chosen)
+void trialBitplanes(const Bitmap<unsigned char>& in, BitplanesTrial& trial, unsigned int N, unsigned int NMAX) {
+    unsigned int width = in.width(), height = in.height();
+    std::vector<Process::Bitplane> bits;
+    Process::toBitplanes(in, bits, N);
+    trial.streams.assign(3 * N, BitWriter());
+    trial.sizes.assign(3 * N, 0);
+    trial.codecs.assign(N, RLE_CODEC);
+    ThreadPool::global().parallelFor(3 * (N - NMAX), [&](unsigned int k) {
+        unsigned int b = NMAX + k / 3;
+        if (k % 3 == RLE_CODEC)
+            trial.sizes[3 * b + RLE_CODEC] = Process::arithmeticEncoding(bits, width, height, trial.streams[3 * b + RLE_CODEC], b + 1, b, 16, true);
+        else if (k % 3 == RAW_CODEC)
+            trial.sizes[3 * b + RAW_CODEC] = Process::rawEncoding(bits, width, height, trial.streams[3 * b + RAW_CODEC], b + 1, b);
+        else
+            trial.sizes[3 * b + CONTEXT_CODEC] = Process::contextCost(in, N, NMAX, 1u << b);
+    });
+    trial.planes = 0;
+    trial.cost = 2 * (N - NMAX);
+    for (unsigned int b = N; b-- > NMAX; ) {
+        unsigned int R = trial.sizes[3 * b + RLE_CODEC], W = trial.sizes[3 * b + RAW_CODEC], C = trial.sizes[3 * b + CONTEXT_CODEC];
+        trial.codecs[b] = (C * 5 < std::min(R, W) * 4) ? CONTEXT_CODEC : (R < W) ? RLE_CODEC : RAW_CODEC;
+        if (trial.codecs[b] == CONTEXT_CODEC)
+            trial.planes |= 1u << b;
+        else if ((std::size_t)width * height >= PARALLEL_AREA)
+            trial.cost += LENGTH_BITS + (unsigned int)std::ceil(std::log2(trial.sizes[3 * b + trial.codecs[b]] + 1.0));
+        trial.cost += trial.sizes[3 * b + trial.codecs[b]];
+    }
+}
+
+// The streams of the run lengths and raw bitplanes of a large plane follow their lengths in bits so that they are decoded at once
+// (each length on its bits count, written on LENGTH_BITS bits)
+unsigned int encodeBitplanes(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX, const BitplanesTrial& trial) {
+    unsigned int count = out.size(), width = in.width(), height = in.height();
+    for (unsigned int b = N; b-- > NMAX; )
+        out.write(trial.codecs[b], 2);
+    for (unsigned int b = N; b-- > NMAX && (std::size_t)width * height >= PARALLEL_AREA; ) {
+        if (trial.codecs[b] != CONTEXT_CODEC) {
+            unsigned int size = trial.sizes[3 * b + trial.codecs[b]], length = (unsigned int)std::ceil(std::log2(size + 1.0));
+            out.write(length, LENGTH_BITS);
+            out.write(size, length);
+        }
+    }
+    for (unsigned int b = N; b-- > NMAX; ) {
+        if (trial.codecs[b] != CONTEXT_CODEC)
+            out.append(trial.streams[3 * b + trial.codecs[b]]);
+    }
+    if (trial.planes)
+        Process::contextEncoding(in, out, N, NMAX, trial.planes);
+    return out.size() - count;
+}
+
+unsigned int encodeBitplanes(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX) {
+    BitplanesTrial trial;
+    trialBitplanes(in, trial, N, NMAX);
+    return encodeBitplanes(in, out, N, NMAX, trial);
+}
+
+unsigned int decodeBitplanes(BitReader& in, Bitmap<unsigned char>& out, unsigned int version, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX) {
+    if (version < 3)
+        return Process::invertArithmeticEncoding(in, out, width, height, N, NMAX, 16);
+    std::size_t count = in.position();
+    std::vector<unsigned int> codecs(N);
+    unsigned int planes = 0;
+    for (unsigned int b = N; b-- > NMAX; ) {
+        codecs[b] = (unsigned int)in.read(2);
+        if (codecs[b] == CONTEXT_CODEC)
+            planes |= 1u << b;
+    }
+    // Bitplanes are decoded packed (at once when their lengths are known, each from its own reader), then merged in a single pass
+    std::vector<Process::Bitplane> bits(N);
+    std::vector<BitReader> readers(N, in);
+    auto decode = [&](unsigned int b) {
+        if (codecs[b] == RLE_CODEC)
+            Process::invertArithmeticEncoding(readers[b], bits, width, height, b + 1, b, 16, version >= 6);
+        else if (codecs[b] == RAW_CODEC)
+            Process::invertRawEncoding(readers[b], bits, width, height, b + 1, b);
+    };
+    if (version >= 8 && (std::size_t)width * height >= PARALLEL_AREA) {
+        std::vector<std::size_t> sizes(N);
+        for (unsigned int b = N; b-- > NMAX; ) {
+            if (codecs[b] != CONTEXT_CODEC)
+                sizes[b] = (std::size_t)in.read((unsigned int)in.read(LENGTH_BITS));
+        }
+        for (unsigned int b = N; b-- > NMAX; ) {
+            readers[b] = in;
+            in.skip(sizes[b]);
+        }
+        ThreadPool::global().parallelFor(N - NMAX, [&](unsigned int k) { decode(NMAX + k); });
+    }
+    else {
+        for (unsigned int b = N; b-- > NMAX; ) {
+            readers[b] = in;
+            decode(b);
+            in = readers[b];
+        }
     }
+    Process::fromBitplanes(bits, out, width, height, N, NMAX, ~planes);
+    if (planes)
+        Process::invertContextEncoding(in, out, width, height, N, NMAX, planes);
+    return in.position() - count;
 }
@@ -1,18 +1,374 @@
 #include "process.h"
 #include "huffman.h"
+#include "rangecoder.h"
+#include "rans.h"
+#include "thread-pool.h"
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+// AVX2 kernels are also compiled without -mavx2, to be selected at run time
+#if defined(__AVX2__) || (defined(__SSE2__) && defined(__GNUC__))
+#define AVX2_KERNELS
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <array>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Process {
+
+    // Pixels from which the kernels are spread over the threads pool
+    const std::size_t PARALLEL_PIXELS = 1 << 16;
+
+    // Run a kernel on the rows of an image, by bands of rows (from its first row to its last row excluded) for a large image
+    template <typename Kernel>
+    inline void forRows(unsigned int width, unsigned int height, Kernel kernel) {
+        if ((std::size_t)width * height < PARALLEL_PIXELS)
+            kernel(0u, height);
+        else
+            ThreadPool::global().parallelRows(height, kernel);
+    }
+
+    // Logarithmic code of a distance d above or below 128, on count values at each side (scale is 128 for LogQuantify, 64 for LogQuantify2)
+    inline unsigned int logCode(float d, float count, float scale, bool above) {
+        if (above)
+            return (unsigned int)(scale * (std::log2(d) + 1.0f) / count + count);
+        return (unsigned int)(count - scale * (std::log2(d) + 1.0f) / count);
+    }
+
+    // Logarithmic quantification of a difference centred on 128
+    inline unsigned char logQuantify(float x, float count, float scale) {
+        if (x > 128.0f)
+            return (unsigned char)logCode(x - 128.0f, count, scale, true);
+        else if (x < 128.0f)
+            return (unsigned char)logCode(128.0f - x, count, scale, false);
+        return (unsigned char)(unsigned int)count;
+    }
+
+    // Value of a logarithmic code, centred on the code C (factor is 1 for LogUnquantify, 2 for LogUnquantify2)
+    inline float logUnquantify(unsigned char x, unsigned char C, float den, float factor) {
+        if (x == C)
+            return 128.0f;
+        else if (x > C)
+            return 128.0f + factor * std::pow(2.0f, ((float)(x - C)) * den);
+        return 128.0f - factor * std::pow(2.0f, ((float)(C - x)) * den);
+    }
+
+    // Logarithmic quantification on N bits by tables, with the same results as logQuantify and logUnquantify : the value of each code,
+    // and on each side of 128 the codes of the distances from 1 to a limit (where the codes are positive, so monotonic) by cells of
+    // 1 / STEPS : the code changes at most once in most cells, at a threshold found on the floats (the differences are seldom whole numbers)
+    class LogTable {
+
+        struct Cell {
+            float threshold;            // distance from which the code is after (infinity if the code does not change)
+            unsigned char before, after;
+            bool direct;                // the code changes more than once, it is computed
+        };
+
+        static const unsigned int STEPS = 8;
+
+        float count, scale;
+        std::vector<Cell> cells[2];
+        float limits[2];
+        float values[256];
+
+        static float nextFloat(float x, int step) {
+            uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            bits += step;
+            std::memcpy(&x, &bits, sizeof(bits));
+            return x;
+        }
+
+        // First distance of ]a, b] with the code of b, by dichotomy on the floats
+        float change(float a, float b, bool above) const {
+            unsigned int code = logCode(b, count, scale, above);
+            uint32_t bitsA, bitsB;
+            std::memcpy(&bitsA, &a, sizeof(bitsA));
+            std::memcpy(&bitsB, &b, sizeof(bitsB));
+            while (bitsB - bitsA > 1) {
+                uint32_t bitsM = bitsA + (bitsB - bitsA) / 2;
+                float m;
+                std::memcpy(&m, &bitsM, sizeof(m));
+                if (logCode(m, count, scale, above) == code)
+                    bitsB = bitsM;
+                else
+                    bitsA = bitsM;
+            }
+            std::memcpy(&b, &bitsB, sizeof(b));
+            return b;
+        }
+
+    public:
+
+        // Distances from which the codes are computed
+        static const unsigned int MAX_DISTANCE = 1024;
+
+        LogTable(unsigned int N, float scale, float factor) : count((float)(1 << (N - 1))), scale(scale) {
+            unsigned char C = (unsigned char)(1 << (N - 1));
+            float den = 7.0f / count;
+            for (unsigned int k = 0; k < 256; k++)
+                values[k] = logUnquantify((unsigned char)k, C, den, factor);
+            for (unsigned int s = 0; s < 2; s++) {
+                bool above = (s == 0);
+                // Below 128, the code decreases with the distance
+                unsigned int limit = 1;
+                while (limit < MAX_DISTANCE && (above || count - scale * (std::log2((float)(limit + 1)) + 1.0f) / count >= 0.0f))
+                    limit++;
+                limits[s] = (float)limit;
+                cells[s].resize(limit * STEPS);
+                for (unsigned int c = STEPS; c < limit * STEPS; c++) {
+                    Cell& cell = cells[s][c];
+                    float a = (float)c / STEPS, b = nextFloat((float)(c + 1) / STEPS, -1);
+                    unsigned int first = logCode(a, count, scale, above), last = logCode(b, count, scale, above);
+                    cell.before = (unsigned char)first;
+                    cell.after = (unsigned char)last;
+                    cell.threshold = std::numeric_limits<float>::infinity();
+                    cell.direct = false;
+                    if (first != last) {
+                        cell.threshold = change(a, b, above);
+                        cell.direct = (logCode(nextFloat(cell.threshold, -1), count, scale, above) != first);
+                    }
+                }
+            }
+        }
+
+        unsigned char quantify(float x) const {
+            // The distance below 128 is the same as 128 - x
+            float d = std::fabs(x - 128.0f);
+            unsigned int s = (x > 128.0f) ? 0 : 1;
+            if (d >= 1.0f && d < limits[s]) {
+                const Cell& cell = cells[s][(unsigned int)(d * STEPS)];
+                if (!cell.direct)
+                    return (d >= cell.threshold) ? cell.after : cell.before;
+            }
+            return logQuantify(x, count, scale);
+        }
+
+        float unquantify(unsigned char x) const { return values[x]; }
+
+    };
+
+    // Tables of the quantification on N bits (of LogQuantify2 and LogUnquantify2 if half), built on their first use
+    const LogTable& logTable(unsigned int N, bool half = false) {
+        static std::once_flag built[2][9];
+        static std::unique_ptr<LogTable> tables[2][9];
+        std::call_once(built[half][N], [&]() { tables[half][N].reset(new LogTable(N, half ? 64.0f : 128.0f, half ? 2.0f : 1.0f)); });
+        return *tables[half][N];
+    }
+
+}
+
+namespace Process {
+
+    // Colour conversions of count pixels (the rows of the planes), the vectorized ones compute the same operations in the same order
+    // as the scalar ones (the results are the same to the bit)
+
+    void toGrayscaleScalar(const unsigned char * r, const unsigned char * g, const unsigned char * b, unsigned char * y, std::size_t count) {
+        for (std::size_t k = 0; k < count; k++)
+            y[k] = r[k] * 0.299f + g[k] * 0.587f + b[k] * 0.114f;
+    }
+
+    void toYCrCbScalar(const unsigned char * r, const unsigned char * g, const unsigned char * b, float * y, float * cr, float * cb, std::size_t count) {
+        for (std::size_t k = 0; k < count; k++) {
+            y[k]  = std::max(0.0f, std::min(255.0f, (float)r[k] * 0.299f + (float)g[k] * 0.587f + (float)b[k] * 0.114f));
+            cr[k] = std::max(0.0f, std::min(255.0f, (float)r[k] * 0.500f - (float)g[k] * 0.4187f - (float)b[k] * 0.0813f + 128.0f));
+            cb[k] = std::max(0.0f, std::min(255.0f, -(float)r[k] * 0.1687f - (float)g[k] * 0.3313f + (float)b[k] * 0.500f + 128.0f));
+        }
+    }
+
+    void toRGBScalar(const float * y, const float * cr, const float * cb, unsigned char * r, unsigned char * g, unsigned char * b, std::size_t count) {
+        for (std::size_t k = 0; k < count; k++) {
+            r[k] = std::max(0.0f, std::min(255.0f, 1.0000f * y[k] + 1.402f * (cr[k] - 128.0f) + 0.0000f * (cb[k] - 128.0f)));
+            g[k] = std::max(0.0f, std::min(255.0f, 1.0000f * y[k] - 0.71414f * (cr[k] - 128.0f) - 0.34414f * (cb[k] - 128.0f)));
+            b[k] = std::max(0.0f, std::min(255.0f, 1.0000f * y[k] + 0.0000f * (cr[k] - 128.0f) + 1.772f * (cb[k] - 128.0f)));
+        }
+    }
+
+#if defined(__SSE2__)
+    // 4 pixels as floats
+    inline __m128 loadPixels(const unsigned char * data) {
+        int word;
+        std::memcpy(&word, data, 4);
+        __m128i zero = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), zero));
+    }
+
+    // 4 pixels truncated from floats in [0, 255]
+    inline void storePixels(unsigned char * data, __m128 x) {
+        __m128i v = _mm_cvttps_epi32(x);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        int word = _mm_cvtsi128_si32(v);
+        std::memcpy(data, &word, 4);
+    }
+
+    // Clamped to [0, 255] as std::max(0, std::min(255, x))
+    inline __m128 clampPixels(__m128 x) {
+        return _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(255.0f)), _mm_setzero_ps());
+    }
+
+    void toGrayscaleSSE2(const unsigned char * r, const unsigned char * g, const unsigned char * b, unsigned char * y, std::size_t count) {
+        std::size_t k = 0;
+        for (; k + 4 <= count; k += 4) {
+            __m128 R = loadPixels(r + k), G = loadPixels(g + k), B = loadPixels(b + k);
+            storePixels(y + k, _mm_add_ps(_mm_add_ps(_mm_mul_ps(R, _mm_set1_ps(0.299f)), _mm_mul_ps(G, _mm_set1_ps(0.587f))),
+                                          _mm_mul_ps(B, _mm_set1_ps(0.114f))));
+        }
+        toGrayscaleScalar(r + k, g + k, b + k, y + k, count - k);
+    }
+
+    void toYCrCbSSE2(const unsigned char * r, const unsigned char * g, const unsigned char * b, float * y, float * cr, float * cb, std::size_t count) {
+        const __m128 sign = _mm_set1_ps(-0.0f), offset = _mm_set1_ps(128.0f);
+        std::size_t k = 0;
+        for (; k + 4 <= count; k += 4) {
+            __m128 R = loadPixels(r + k), G = loadPixels(g + k), B = loadPixels(b + k);
+            __m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(R, _mm_set1_ps(0.299f)), _mm_mul_ps(G, _mm_set1_ps(0.587f))), _mm_mul_ps(B, _mm_set1_ps(0.114f))),
+                   Cr = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(R, _mm_set1_ps(0.500f)), _mm_mul_ps(G, _mm_set1_ps(0.4187f))), _mm_mul_ps(B, _mm_set1_ps(0.0813f))),
+                   Cb = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_xor_ps(R, sign), _mm_set1_ps(0.1687f)), _mm_mul_ps(G, _mm_set1_ps(0.3313f))), _mm_mul_ps(B, _mm_set1_ps(0.500f)));
+            _mm_storeu_ps(y + k, clampPixels(Y));
+            _mm_storeu_ps(cr + k, clampPixels(_mm_add_ps(Cr, offset)));
+            _mm_storeu_ps(cb + k, clampPixels(_mm_add_ps(Cb, offset)));
+        }
+        toYCrCbScalar(r + k, g + k, b + k, y + k, cr + k, cb + k, count - k);
+    }
+
+    void toRGBSSE2(const float * y, const float * cr, const float * cb, unsigned char * r, unsigned char * g, unsigned char * b, std::size_t count) {
+        const __m128 offset = _mm_set1_ps(128.0f), one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+        std::size_t k = 0;
+        for (; k + 4 <= count; k += 4) {
+            __m128 Y = _mm_mul_ps(one, _mm_loadu_ps(y + k)), Cr = _mm_sub_ps(_mm_loadu_ps(cr + k), offset), Cb = _mm_sub_ps(_mm_loadu_ps(cb + k), offset);
+            storePixels(r + k, clampPixels(_mm_add_ps(_mm_add_ps(Y, _mm_mul_ps(_mm_set1_ps(1.402f), Cr)), _mm_mul_ps(zero, Cb))));
+            storePixels(g + k, clampPixels(_mm_sub_ps(_mm_sub_ps(Y, _mm_mul_ps(_mm_set1_ps(0.71414f), Cr)), _mm_mul_ps(_mm_set1_ps(0.34414f), Cb))));
+            storePixels(b + k, clampPixels(_mm_add_ps(_mm_add_ps(Y, _mm_mul_ps(zero, Cr)), _mm_mul_ps(_mm_set1_ps(1.772f), Cb))));
+        }
+        toRGBScalar(y + k, cr + k, cb + k, r + k, g + k, b + k, count - k);
+    }
+#endif
+
+#if defined(AVX2_KERNELS)
+    // 8 pixels as floats
+    __attribute__((target("avx2"))) inline __m256 loadPixels8(const unsigned char * data) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)data)));
+    }
+
+    // 8 pixels truncated from floats in [0, 255]
+    __attribute__((target("avx2"))) inline void storePixels8(unsigned char * data, __m256 x) {
+        __m256i v = _mm256_cvttps_epi32(x);
+        __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i *)data, _mm_packus_epi16(w, w));
+    }
+
+    __attribute__((target("avx2"))) inline __m256 clampPixels8(__m256 x) {
+        return _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(255.0f)), _mm256_setzero_ps());
+    }
+
+    __attribute__((target("avx2")))
+    void toGrayscaleAVX2(const unsigned char * r, const unsigned char * g, const unsigned char * b, unsigned char * y, std::size_t count) {
+        std::size_t k = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m256 R = loadPixels8(r + k), G = loadPixels8(g + k), B = loadPixels8(b + k);
+            storePixels8(y + k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(R, _mm256_set1_ps(0.299f)), _mm256_mul_ps(G, _mm256_set1_ps(0.587f))),
+                                              _mm256_mul_ps(B, _mm256_set1_ps(0.114f))));
+        }
+        toGrayscaleScalar(r + k, g + k, b + k, y + k, count - k);
+    }
+
+    __attribute__((target("avx2")))
+    void toYCrCbAVX2(const unsigned char * r, const unsigned char * g, const unsigned char * b, float * y, float * cr, float * cb, std::size_t count) {
+        const __m256 sign = _mm256_set1_ps(-0.0f), offset = _mm256_set1_ps(128.0f);
+        std::size_t k = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m256 R = loadPixels8(r + k), G = loadPixels8(g + k), B = loadPixels8(b + k);
+            __m256 Y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(R, _mm256_set1_ps(0.299f)), _mm256_mul_ps(G, _mm256_set1_ps(0.587f))), _mm256_mul_ps(B, _mm256_set1_ps(0.114f))),
+                   Cr = _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(R, _mm256_set1_ps(0.500f)), _mm256_mul_ps(G, _mm256_set1_ps(0.4187f))), _mm256_mul_ps(B, _mm256_set1_ps(0.0813f))),
+                   Cb = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_xor_ps(R, sign), _mm256_set1_ps(0.1687f)), _mm256_mul_ps(G, _mm256_set1_ps(0.3313f))), _mm256_mul_ps(B, _mm256_set1_ps(0.500f)));
+            _mm256_storeu_ps(y + k, clampPixels8(Y));
+            _mm256_storeu_ps(cr + k, clampPixels8(_mm256_add_ps(Cr, offset)));
+            _mm256_storeu_ps(cb + k, clampPixels8(_mm256_add_ps(Cb, offset)));
+        }
+        toYCrCbScalar(r + k, g + k, b + k, y + k, cr + k, cb + k, count - k);
+    }
+
+    __attribute__((target("avx2")))
+    void toRGBAVX2(const float * y, const float * cr, const float * cb, unsigned char * r, unsigned char * g, unsigned char * b, std::size_t count) {
+        const __m256 offset = _mm256_set1_ps(128.0f), one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+        std::size_t k = 0;
+        for (; k + 8 <= count; k += 8) {
+            __m256 Y = _mm256_mul_ps(one, _mm256_loadu_ps(y + k)), Cr = _mm256_sub_ps(_mm256_loadu_ps(cr + k), offset), Cb = _mm256_sub_ps(_mm256_loadu_ps(cb + k), offset);
+            storePixels8(r + k, clampPixels8(_mm256_add_ps(_mm256_add_ps(Y, _mm256_mul_ps(_mm256_set1_ps(1.402f), Cr)), _mm256_mul_ps(zero, Cb))));
+            storePixels8(g + k, clampPixels8(_mm256_sub_ps(_mm256_sub_ps(Y, _mm256_mul_ps(_mm256_set1_ps(0.71414f), Cr)), _mm256_mul_ps(_mm256_set1_ps(0.34414f), Cb))));
+            storePixels8(b + k, clampPixels8(_mm256_add_ps(_mm256_add_ps(Y, _mm256_mul_ps(zero, Cr)), _mm256_mul_ps(_mm256_set1_ps(1.772f), Cb))));
+        }
+        toRGBScalar(y + k, cr + k, cb + k, r + k, g + k, b + k, count - k);
+    }
+#endif
+
+    typedef void (*ToGrayscaleRow)(const unsigned char *, const unsigned char *, const unsigned char *, unsigned char *, std::size_t);
+    typedef void (*ToYCrCbRow)(const unsigned char *, const unsigned char *, const unsigned char *, float *, float *, float *, std::size_t);
+    typedef void (*ToRGBRow)(const float *, const float *, const float *, unsigned char *, unsigned char *, unsigned char *, std::size_t);
+
+    // Conversions of each instruction set (the best compiled one below it when missing)
+#if defined(__SSE2__) && defined(AVX2_KERNELS)
+    const ToGrayscaleRow toGrayscaleRows[3] = { toGrayscaleScalar, toGrayscaleSSE2, toGrayscaleAVX2 };
+    const ToYCrCbRow toYCrCbRows[3] = { toYCrCbScalar, toYCrCbSSE2, toYCrCbAVX2 };
+    const ToRGBRow toRGBRows[3] = { toRGBScalar, toRGBSSE2, toRGBAVX2 };
+#elif defined(__SSE2__)
+    const ToGrayscaleRow toGrayscaleRows[3] = { toGrayscaleScalar, toGrayscaleSSE2, toGrayscaleSSE2 };
+    const ToYCrCbRow toYCrCbRows[3] = { toYCrCbScalar, toYCrCbSSE2, toYCrCbSSE2 };
+    const ToRGBRow toRGBRows[3] = { toRGBScalar, toRGBSSE2, toRGBSSE2 };
+#else
+    const ToGrayscaleRow toGrayscaleRows[3] = { toGrayscaleScalar, toGrayscaleScalar, toGrayscaleScalar };
+    const ToYCrCbRow toYCrCbRows[3] = { toYCrCbScalar, toYCrCbScalar, toYCrCbScalar };
+    const ToRGBRow toRGBRows[3] = { toRGBScalar, toRGBScalar, toRGBScalar };
+#endif
+
+    // Instruction set of the conversions (negative until selected)
+    std::atomic<int> simdUsed(-1);
+
+    inline Simd usedSimd() {
+        int simd = simdUsed.load();
+        if (simd < 0) {
+            simd = supportedSimd();
+            simdUsed.store(simd);
+        }
+        return (Simd)simd;
+    }
+
+}
+
+Process::Simd Process::supportedSimd() {
+#if defined(AVX2_KERNELS)
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+#endif
+#if defined(__SSE2__)
+    return SIMD_SSE2;
+#else
+    return SIMD_NONE;
+#endif
+}
+
+void Process::useSimd(Simd simd) {
+    simdUsed.store(std::min(simd, supportedSimd()));
+}
 
 void Process::toGrayscale(const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B, Bitmap<unsigned char>& Y) {
     if (R.width() != Y.width() || R.height() != Y.height())
         Y.resize(R.width(), R.height());
-    for (unsigned int i = 0, h = R.height(); i < h; i++) {
-        for (unsigned int j = 0, w = R.width(); j < w; j++) {
-            Y[i][j] = R[i][j] * 0.299f + G[i][j] * 0.587f + B[i][j] * 0.114f;
-        }
-    }
+    ToGrayscaleRow row = toGrayscaleRows[usedSimd()];
+    std::size_t w = R.width();
+    forRows(R.width(), R.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t i = first; i < last; i++)
+            row(R.data() + i * w, G.data() + i * w, B.data() + i * w, Y.data() + i * w, w);
+    });
 }
 
 void Process::toYCrCb(const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B, Bitmap<float>& Y, Bitmap<float>& Cr, Bitmap<float>& Cb) {
@@ -22,15 +378,15 @@ void Process::toYCrCb(const Bitmap<unsigned char>& R, const Bitmap<unsigned char
         Cr.resize(R.width(), R.height());
     if (R.width() != Cb.width() || R.height() != Cb.height())
         Cb.resize(R.width(), R.height());
-    for (unsigned int i = 0, h = R.height(); i < h; i++) {
-        for (unsigned int j = 0, w = R.width(); j < w; j++) {
-            Y[i][j]  = std::max(0.0f, std::min(255.0f, (float)R[i][j] * 0.299f + (float)G[i][j] * 0.587f + (float)B[i][j] * 0.114f));
-            Cr[i][j] = std::max(0.0f, std::min(255.0f, (float)R[i][j] * 0.500f - (float)G[i][j] * 0.4187f - (float)B[i][j] * 0.0813f + 128.0f));
-            Cb[i][j] = std::max(0.0f, std::min(255.0f, -(float)R[i][j] * 0.1687f - (float)G[i][j] * 0.3313f + (float)B[i][j] * 0.500f + 128.0f));
-        }
-    }
+    ToYCrCbRow row = toYCrCbRows[usedSimd()];
+    std::size_t w = R.width();
+    forRows(R.width(), R.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t i = first; i < last; i++)
+            row(R.data() + i * w, G.data() + i * w, B.data() + i * w, Y.data() + i * w, Cr.data() + i * w, Cb.data() + i * w, w);
+    });
 }
 
+// The chroma planes may be wider than the luminance
 void Process::toRGB(const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitmap<float>& Cb, Bitmap<unsigned char>& R, Bitmap<unsigned char>& G, Bitmap<unsigned char>& B) {
     if (Y.width() != R.width() || Y.height() != R.height())
         R.resize(Y.width(), Y.height());
@@ -38,13 +394,175 @@ void Process::toRGB(const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitma
         G.resize(Y.width(), Y.height());
     if (Y.width() != B.width() || Y.height() != B.height())
         B.resize(Y.width(), Y.height());
-    for (unsigned int i = 0, h = R.height(); i < h; i++) {
-        for (unsigned int j = 0, w = R.width(); j < w; j++) {
-            R[i][j] = std::max(0.0f, std::min(255.0f, 1.0000f * Y[i][j] + 1.402f * (Cr[i][j] - 128.0f) + 0.0000f * (Cb[i][j] - 128.0f)));
-            G[i][j] = std::max(0.0f, std::min(255.0f, 1.0000f * Y[i][j] - 0.71414f * (Cr[i][j] - 128.0f) - 0.34414f * (Cb[i][j] - 128.0f)));
-            B[i][j] = std::max(0.0f, std::min(255.0f, 1.0000f * Y[i][j] + 0.0000f * (Cr[i][j] - 128.0f) + 1.772f * (Cb[i][j] - 128.0f)));
+    ToRGBRow row = toRGBRows[usedSimd()];
+    std::size_t w = Y.width(), wr = Cr.width(), wb = Cb.width();
+    forRows(Y.width(), Y.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t i = first; i < last; i++)
+            row(Y.data() + i * w, Cr.data() + i * wr, Cb.data() + i * wb, R.data() + i * w, G.data() + i * w, B.data() + i * w, w);
+    });
+}
+
+namespace Process {
+
+    // Split an interleaved RGB row in the rows of its planes
+    inline void splitRow(const unsigned char * rgb, unsigned int width, unsigned char * r, unsigned char * g, unsigned char * b) {
+        for (unsigned int j = 0; j < width; j++) {
+            r[j] = rgb[j * 3];
+            g[j] = rgb[j * 3 + 1];
+            b[j] = rgb[j * 3 + 2];
+        }
+    }
+
+    // Interleave the rows of the planes in an RGB row
+    inline void mergeRow(const unsigned char * r, const unsigned char * g, const unsigned char * b, unsigned int width, unsigned char * rgb) {
+        for (unsigned int j = 0; j < width; j++) {
+            rgb[j * 3] = r[j];
+            rgb[j * 3 + 1] = g[j];
+            rgb[j * 3 + 2] = b[j];
         }
     }
+
+    // Interleaved RGB rows from the luminance rows given by a kernel (row index, float row) and the quantified chroma on 7 bits,
+    // enlarged 2 times and extended from their last row and column (with the operations of Unquantify, Enlarge2, Extend and toRGB)
+    template <typename Luminance>
+    void decodedRGB(const Bitmap<unsigned char>& CrQ, const Bitmap<unsigned char>& CbQ, unsigned int width, unsigned int height,
+                    unsigned char * rgb, Luminance luminance) {
+        ToRGBRow row = toRGBRows[usedSimd()];
+        std::size_t w = width;
+        unsigned int cw = CrQ.width(), ch = CrQ.height();
+        forRows(width, height, [&](unsigned int first, unsigned int last) {
+            std::vector<float> Y(w), Cr(w), Cb(w);
+            std::vector<unsigned char> planes(3 * w);
+            for (std::size_t i = first; i < last; i++) {
+                luminance((unsigned int)i, Y.data());
+                if (cw && ch) {
+                    std::size_t ci = std::min((unsigned int)i / 2, ch - 1);
+                    const unsigned char * cr = CrQ.data() + ci * cw, * cb = CbQ.data() + ci * cw;
+                    for (unsigned int j = 0; j < width; j++) {
+                        unsigned int cj = std::min(j / 2, cw - 1);
+                        Cr[j] = (float)(cr[cj] << 1);
+                        Cb[j] = (float)(cb[cj] << 1);
+                    }
+                }
+                else {
+                    // No chroma for a single row or column, the pixels are gray
+                    std::fill(Cr.begin(), Cr.end(), 128.0f);
+                    std::fill(Cb.begin(), Cb.end(), 128.0f);
+                }
+                row(Y.data(), Cr.data(), Cb.data(), planes.data(), planes.data() + w, planes.data() + 2 * w, w);
+                mergeRow(planes.data(), planes.data() + w, planes.data() + 2 * w, width, rgb + i * w * 3);
+            }
+        });
+    }
+
+}
+
+void Process::toYCrCb(const unsigned char * rgb, unsigned int width, unsigned int height, Bitmap<float>& Y, Bitmap<float>& Cr, Bitmap<float>& Cb) {
+    if (width != Y.width() || height != Y.height())
+        Y.resize(width, height);
+    if (width != Cr.width() || height != Cr.height())
+        Cr.resize(width, height);
+    if (width != Cb.width() || height != Cb.height())
+        Cb.resize(width, height);
+    ToYCrCbRow row = toYCrCbRows[usedSimd()];
+    std::size_t w = width;
+    forRows(width, height, [&](unsigned int first, unsigned int last) {
+        std::vector<unsigned char> planes(3 * w);
+        for (std::size_t i = first; i < last; i++) {
+            splitRow(rgb + i * w * 3, width, planes.data(), planes.data() + w, planes.data() + 2 * w);
+            row(planes.data(), planes.data() + w, planes.data() + 2 * w, Y.data() + i * w, Cr.data() + i * w, Cb.data() + i * w, w);
+        }
+    });
+}
+
+// Each pair of rows is converted in rows buffers, then its luminance is filtered and quantified and its chroma reduced and quantified
+// with the operations of toYCrCb, filterMean, filterSub, Quantify, LogQuantify, ReduceQuantify and Reduce2
+void Process::filteredPlanes(const unsigned char * rgb, unsigned int width, unsigned int height, Bitmap<unsigned char>& YQ,
+                             Bitmap<unsigned char>& YMeanQ, Bitmap<unsigned char>& YDiffQ, Bitmap<unsigned char>& CrQ, Bitmap<unsigned char>& CbQ) {
+    unsigned int half = width / 2, cw = (width + 1) / 2, ch = (height + 1) / 2;
+    if (YQ.width() != width || YQ.height() != height)
+        YQ.resize(width, height);
+    if (YMeanQ.width() != half || YMeanQ.height() != height)
+        YMeanQ.resize(half, height);
+    if (YDiffQ.width() != half || YDiffQ.height() != height)
+        YDiffQ.resize(half, height);
+    if (CrQ.width() != cw || CrQ.height() != ch)
+        CrQ.resize(cw, ch);
+    if (CbQ.width() != cw || CbQ.height() != ch)
+        CbQ.resize(cw, ch);
+    ToYCrCbRow row = toYCrCbRows[usedSimd()];
+    const LogTable& table = logTable(6);
+    std::size_t w = width;
+    forRows(2 * width, ch, [&](unsigned int first, unsigned int last) {
+        std::vector<unsigned char> planes(3 * w);
+        std::vector<float> Y(2 * w), Cr(2 * w), Cb(2 * w);
+        for (std::size_t c = first; c < last; c++) {
+            unsigned int rows = std::min(2u, height - 2 * (unsigned int)c);
+            for (unsigned int r = 0; r < rows; r++) {
+                std::size_t i = 2 * c + r;
+                const float * y = &Y[r * w];
+                splitRow(rgb + i * w * 3, width, planes.data(), planes.data() + w, planes.data() + 2 * w);
+                row(planes.data(), planes.data() + w, planes.data() + 2 * w, &Y[r * w], &Cr[r * w], &Cb[r * w], w);
+                unsigned char * yq = YQ.data() + i * w, * mean = YMeanQ.data() + i * half, * diff = YDiffQ.data() + i * half;
+                for (unsigned int j = 0; j < width; j++)
+                    yq[j] = (unsigned char)y[j];
+                for (unsigned int j = 0; j < half; j++) {
+                    mean[j] = (unsigned char)(0.5f * y[j * 2] + 0.5f * y[j * 2 + 1]) >> 1;
+                    diff[j] = table.quantify(y[j * 2 + 1] - y[j * 2] + 128.0f) >> 2;
+                }
+            }
+            bool i21 = (rows == 2);
+            const float * chroma[2] = { Cr.data(), Cb.data() };
+            unsigned char * out[2] = { CrQ.data() + c * cw, CbQ.data() + c * cw };
+            for (unsigned int p = 0; p < 2; p++) {
+                const float * in = chroma[p];
+                for (unsigned int j = 0; j < cw; j++) {
+                    bool j21 = (j * 2 + 1 < width);
+                    float tx = 1.0f / ((i21 ? 2.0f : 1.0f) * (j21 ? 2.0f : 1.0f));
+                    out[p][j] = (unsigned char)(tx * in[j * 2] +
+                                                tx * (j21 ? in[j * 2 + 1] : 0.0f) +
+                                                tx * (i21 ? in[w + j * 2] : 0.0f) +
+                                                tx * (i21 && j21 ? in[w + j * 2 + 1] : 0.0f)) >> 1;
+                }
+            }
+        }
+    });
+}
+
+void Process::toRGB(const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitmap<float>& Cb, unsigned char * rgb) {
+    ToRGBRow row = toRGBRows[usedSimd()];
+    std::size_t w = Y.width(), wr = Cr.width(), wb = Cb.width();
+    forRows(Y.width(), Y.height(), [&](unsigned int first, unsigned int last) {
+        std::vector<unsigned char> planes(3 * w);
+        for (std::size_t i = first; i < last; i++) {
+            row(Y.data() + i * w, Cr.data() + i * wr, Cb.data() + i * wb, planes.data(), planes.data() + w, planes.data() + 2 * w, w);
+            mergeRow(planes.data(), planes.data() + w, planes.data() + 2 * w, (unsigned int)w, rgb + i * w * 3);
+        }
+    });
+}
+
+// The luminance of each pair of pixels follows from its mean and its difference (on 6 bits from its 4 bits)
+void Process::filteredRGB(const Bitmap<unsigned char>& YMeanQ, const Bitmap<unsigned char>& YDiffQ, const Bitmap<unsigned char>& CrQ,
+                          const Bitmap<unsigned char>& CbQ, unsigned char * rgb) {
+    const LogTable& table = logTable(6);
+    unsigned int half = YMeanQ.width();
+    decodedRGB(CrQ, CbQ, 2 * half, YMeanQ.height(), rgb, [&](unsigned int i, float * Y) {
+        const unsigned char * mean = YMeanQ.data() + (std::size_t)i * half, * diff = YDiffQ.data() + (std::size_t)i * half;
+        for (unsigned int j = 0; j < half; j++) {
+            float m = (float)(mean[j] << 1), d = table.unquantify((unsigned char)(diff[j] << 2));
+            Y[j * 2] = m - (d - 128.0f) / 2.0f;
+            Y[j * 2 + 1] = m + (d - 128.0f) / 2.0f;
+        }
+    });
+}
+
+void Process::mergedRGB(const Bitmap<unsigned char>& YQ, const Bitmap<unsigned char>& CrQ, const Bitmap<unsigned char>& CbQ, unsigned char * rgb) {
+    unsigned int width = YQ.width();
+    decodedRGB(CrQ, CbQ, width, YQ.height(), rgb, [&](unsigned int i, float * Y) {
+        const unsigned char * y = YQ.data() + (std::size_t)i * width;
+        for (unsigned int j = 0; j < width; j++)
+            Y[j] = (float)(y[j] << 2);
+    });
 }
 
 float Process::calculatePSNR(const Bitmap<unsigned char>& first, const Bitmap<unsigned char>& second) {
@@ -59,220 +577,294 @@ float Process::calculatePSNR(const Bitmap<unsigned char>& first, const Bitmap<un
     return 10.0f * std::log10((float)(255 * 255) / eqm);
 }
 
+float Process::calculatePSNR(const std::array<unsigned int, 256>& histogram, const std::array<unsigned char, 256>& table) {
+    double eqm = 0.0, count = 0.0;
+    for (unsigned int v = 0; v < 256; v++) {
+        eqm += (double)histogram[v] * ((double)v - (double)table[v]) * ((double)v - (double)table[v]);
+        count += (double)histogram[v];
+    }
+    return 10.0f * std::log10((float)(255 * 255) / (float)(eqm / count));
+}
+
 void Process::Reduce2(const Bitmap<float>& in, Bitmap<float>& out) {
     unsigned int w = (in.width() + 1) / 2, w2 = in.width(),
                  h = (in.height() + 1) / 2, h2 = in.height();
-    if (in.width() != w || in.height() != h)
+    if (out.width() != w || out.height() != h)
         out.resize(w, h);
-    for (unsigned int i = 0; i < h; i++) {
-        for (unsigned int j = 0; j < w; j++) {
-            bool i21 = (i * 2 + 1 < h2), j21 = (j * 2 + 1 < w2);
-            float tx = 1.0f / ((i21 ? 2.0f : 1.0f) * (j21 ? 2.0f : 1.0f));
-            out[i][j] = tx * (float)in[i * 2][j * 2] +
-                        tx * (j21 ? (float)in[i * 2][j * 2 + 1] : 0.0f) +
-                        tx * (i21 ? (float)in[i * 2 + 1][j * 2] : 0.0f) +
-                        tx * (i21 && j21 ? (float)in[i * 2 + 1][j * 2 + 1] : 0.0f);
+    forRows(w, h, [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0; j < w; j++) {
+                bool i21 = (i * 2 + 1 < h2), j21 = (j * 2 + 1 < w2);
+                float tx = 1.0f / ((i21 ? 2.0f : 1.0f) * (j21 ? 2.0f : 1.0f));
+                out[i][j] = tx * (float)in[i * 2][j * 2] +
+                            tx * (j21 ? (float)in[i * 2][j * 2 + 1] : 0.0f) +
+                            tx * (i21 ? (float)in[i * 2 + 1][j * 2] : 0.0f) +
+                            tx * (i21 && j21 ? (float)in[i * 2 + 1][j * 2 + 1] : 0.0f);
+            }
         }
-    }
+    });
 }
 
 void Process::Enlarge2(const Bitmap<float>& in, Bitmap<float>& out) {
     if (in.width() * 2 != out.width() || in.height() * 2 != out.height())
         out.resize(in.width() * 2, in.height() * 2);
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i * 2][j * 2] = in[i][j];
-            out[i * 2][j * 2 + 1] = in[i][j];
-            out[i * 2 + 1][j * 2] = in[i][j];
-            out[i * 2 + 1][j * 2 + 1] = in[i][j];
+    forRows(out.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i * 2][j * 2] = in[i][j];
+                out[i * 2][j * 2 + 1] = in[i][j];
+                out[i * 2 + 1][j * 2] = in[i][j];
+                out[i * 2 + 1][j * 2 + 1] = in[i][j];
+            }
         }
-    }
+    });
+}
+
+void Process::Extend(const Bitmap<float>& in, Bitmap<float>& out, unsigned int width, unsigned int height) {
+    Bitmap<float> tmp(width, height);
+    forRows(width, height, [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            unsigned int _i = std::min(i, in.height() - 1);
+            for (unsigned int j = 0; j < width; j++)
+                tmp[i][j] = in[_i][std::min(j, in.width() - 1)];
+        }
+    });
+    out = tmp;
 }
 
 void Process::Quantify(const Bitmap<float>& in, Bitmap<unsigned char>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = (unsigned char)in[i][j] >> (8 - N);
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = (unsigned char)in[i][j] >> (8 - N);
+            }
         }
-    }
+    });
 }
 
 void Process::ReduceQuantify(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = (in[i][j] >> N);
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = (in[i][j] >> N);
+            }
         }
-    }
+    });
 }
 
 void Process::Unquantify(const Bitmap<unsigned char>& in, Bitmap<float>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = (float)(in[i][j] << (8 - N));
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = (float)(in[i][j] << (8 - N));
+            }
         }
-    }
+    });
 }
     
 void Process::EnlargeQuantify(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = in[i][j] << N;
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = in[i][j] << N;
+            }
         }
-    }
+    });
 }
 
 void Process::LogQuantify(const Bitmap<float>& in, Bitmap<unsigned char>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    float count = (float)(1 << (N - 1));
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            if (in[i][j] > 128.0f)
-                out[i][j] = (unsigned int)(128.0f * (std::log2(in[i][j] - 128.0f) + 1.0f) / count + count);
-            else if (in[i][j] < 128.0f)
-                out[i][j] = (unsigned int)(count - 128.0f * (std::log2(128.0f - in[i][j]) + 1.0f) / count);
-            else
-                out[i][j] = (unsigned int)count;
-        }
-    }
+    const LogTable& table = logTable(N);
+    std::size_t w = in.width();
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t k = first * w, end = last * w; k < end; k++)
+            out.data()[k] = table.quantify(in.data()[k]);
+    });
 }
 
 void Process::LogQuantify2(const Bitmap<float>& in, Bitmap<unsigned char>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    float count = (float)(1 << (N - 1));
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            if (in[i][j] > 128.0f)
-                out[i][j] = (unsigned int)(64.0f * (std::log2(in[i][j] - 128.0f) + 1.0f) / count + count);
-            else if (in[i][j] < 128.0f)
-                out[i][j] = (unsigned int)(count - 64.0f * (std::log2(128.0f - in[i][j]) + 1.0f) / count);
-            else
-                out[i][j] = (unsigned int)count;
-        }
-    }
+    const LogTable& table = logTable(N, true);
+    std::size_t w = in.width();
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t k = first * w, end = last * w; k < end; k++)
+            out.data()[k] = table.quantify(in.data()[k]);
+    });
 }
 
 void Process::LogUnquantify(const Bitmap<unsigned char>& in, Bitmap<float>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    float count = (float)(1 << (N - 1));
-    unsigned char C = (1 << (N - 1));
-    float den = 7.0f / count;
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            if (in[i][j] == C)
-                out[i][j] = 128.0f;
-            else if (in[i][j] > C)
-                out[i][j] = 128.0f + std::pow(2.0f, ((float)(in[i][j] - C)) * den);
-            else
-                out[i][j] = 128.0f - std::pow(2.0f, ((float)(C - in[i][j])) * den);
-        }
-    }
+    const LogTable& table = logTable(N);
+    std::size_t w = in.width();
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t k = first * w, end = last * w; k < end; k++)
+            out.data()[k] = table.unquantify(in.data()[k]);
+    });
 }
 
 void Process::LogUnquantify2(const Bitmap<unsigned char>& in, Bitmap<float>& out, unsigned int N) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    float count = (float)(1 << (N - 1));
-    unsigned char C = (1 << (N - 1));
-    float den = 7.0f / count;
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            if (in[i][j] == C)
-                out[i][j] = 128.0f;
-            else if (in[i][j] > C)
-                out[i][j] = 128.0f + 2.0f * std::pow(2.0f, ((float)(in[i][j] - C)) * den);
-            else
-                out[i][j] = 128.0f - 2.0f * std::pow(2.0f, ((float)(C - in[i][j])) * den);
-        }
-    }
+    const LogTable& table = logTable(N, true);
+    std::size_t w = in.width();
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t k = first * w, end = last * w; k < end; k++)
+            out.data()[k] = table.unquantify(in.data()[k]);
+    });
 }
 
 void Process::filterSub(const Bitmap<float>& in, Bitmap<float>& out) {
     if (in.width() / 2 != out.width() || in.height() != out.height())
         out.resize(in.width() / 2, in.height());
-    for (unsigned int i = 0, h = out.height(); i < h; i++) {
-        for (unsigned int j = 0, w = out.width(); j < w; j++) {
-            out[i][j] = in[i][j * 2 + 1] - in[i][j * 2] + 128.0f;
+    forRows(out.width(), out.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = out.width(); j < w; j++) {
+                out[i][j] = in[i][j * 2 + 1] - in[i][j * 2] + 128.0f;
+            }
         }
-    }
+    });
 }
 
 void Process::filterUp(const Bitmap<float>& in, Bitmap<float>& out) {
     if (in.width() != out.width() || in.height() / 2 != out.height())
         out.resize(in.width(), in.height() / 2);
-    for (unsigned int i = 0, h = out.height(); i < h; i++) {
-        for (unsigned int j = 0, w = out.width(); j < w; j++) {
-            out[i][j] = in[i * 2 + 1][j] - in[i * 2][j] + 128.0f;
+    forRows(out.width(), out.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = out.width(); j < w; j++) {
+                out[i][j] = in[i * 2 + 1][j] - in[i * 2][j] + 128.0f;
+            }
         }
-    }
+    });
 }
 
 void Process::filterMean(const Bitmap<float>& in, Bitmap<float>& out) {
     if (in.width() / 2 != out.width() || in.height() != out.height())
         out.resize(in.width() / 2, in.height());
-    for (unsigned int i = 0, h = out.height(); i < h; i++) {
-        for (unsigned int j = 0, w = out.width(); j < w; j++) {
-            out[i][j] = 0.5f * in[i][j * 2] + 0.5f * in[i][j * 2 + 1];
+    forRows(out.width(), out.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = out.width(); j < w; j++) {
+                out[i][j] = 0.5f * in[i][j * 2] + 0.5f * in[i][j * 2 + 1];
+            }
         }
-    }
+    });
 }
 
 void Process::filterMeanUp(const Bitmap<float>& in, Bitmap<float>& out) {
     if (in.width() != out.width() || in.height() / 2 != out.height())
         out.resize(in.width(), in.height() / 2);
-    for (unsigned int i = 0, h = out.height(); i < h; i++) {
-        for (unsigned int j = 0, w = out.width(); j < w; j++) {
-            out[i][j] = 0.5f * in[i * 2][j] + 0.5f * in[i * 2 + 1][j];
+    forRows(out.width(), out.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = out.width(); j < w; j++) {
+                out[i][j] = 0.5f * in[i * 2][j] + 0.5f * in[i * 2 + 1][j];
+            }
         }
-    }
+    });
 }
 
 void Process::invertFilter(const Bitmap<float>& mean, const Bitmap<float>& sub, Bitmap<float>& out) {
     if (mean.width() * 2 != out.width() || mean.height() != out.height())
         out.resize(mean.width() * 2, mean.height());
-    for (unsigned int i = 0, h = out.height(); i < h; i++) {
-        for (unsigned int j = 0, w = mean.width(); j < w; j++) {
-            out[i][j * 2] = mean[i][j] - (sub[i][j] - 128.0f) / 2.0f;
-            out[i][j * 2 + 1] = mean[i][j] + (sub[i][j] - 128.0f) / 2.0f;
+    forRows(out.width(), out.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = mean.width(); j < w; j++) {
+                out[i][j * 2] = mean[i][j] - (sub[i][j] - 128.0f) / 2.0f;
+                out[i][j * 2 + 1] = mean[i][j] + (sub[i][j] - 128.0f) / 2.0f;
+            }
         }
-    }
+    });
 }
 
 void Process::invertFilterUp(const Bitmap<float>& mean, const Bitmap<float>& up, Bitmap<float>& out) {
     if (mean.width() != out.width() || mean.height() * 2 != out.height())
         out.resize(mean.width(), mean.height() * 2);
-    for (unsigned int i = 0, h = mean.height(); i < h; i++) {
-        for (unsigned int j = 0, w = out.width(); j < w; j++) {
-            out[i * 2][j] = mean[i][j] - (up[i][j] - 128.0f) / 2.0f;
-            out[i * 2 + 1][j] = mean[i][j] + (up[i][j] - 128.0f) / 2.0f;
+    forRows(out.width(), mean.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = out.width(); j < w; j++) {
+                out[i * 2][j] = mean[i][j] - (up[i][j] - 128.0f) / 2.0f;
+                out[i * 2 + 1][j] = mean[i][j] + (up[i][j] - 128.0f) / 2.0f;
+            }
         }
-    }
+    });
+}
+
+void Process::histogram(const Bitmap<unsigned char>& in, std::array<unsigned int, 256>& out) {
+    Huffman<8>::histogram(in.data(), in.width() * in.height(), out);
 }
 
-unsigned int Process::huffman(const Bitmap<unsigned char>& in, std::vector<bool>& out, unsigned int N) {
+unsigned int Process::huffman(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, bool canonical, unsigned int maxlen) {
+    std::array<unsigned int, 256> histo;
+    histogram(in, histo);
+    return huffman(in, out, N, histo, canonical, maxlen);
+}
+
+unsigned int Process::huffman(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram, bool canonical, unsigned int maxlen) {
     Huffman<8> huff;
-    huff.create(in.data(), in.width() * in.height(), N);
-    unsigned int it = huff.write(out, N);
+    huff.create(histogram, N, canonical ? maxlen : 0);
+    unsigned int it = canonical ? huff.write_lengths(out, N) : huff.write(out, N);
     return it + huff.write(out, in.data(), in.width() * in.height(), N);
 }
 
-unsigned int Process::invertHuffman(const std::vector<bool>& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N) {
+unsigned int Process::invertHuffman(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N, bool canonical) {
     if (out.width() != width || out.height() != height)
         out.resize(width, height);
     Huffman<8> huff;
-    unsigned int it = huff.read(in, N);
-    std::vector<bool> dta (in.begin() + it, in.end());
-    return it + huff.read(dta, out.data(), width * height);
+    unsigned int it = canonical ? huff.read_lengths(in, N) : huff.read(in, N);
+    return it + huff.read(in, out.data(), width * height);
+}
+
+unsigned int Process::rans(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram) {
+    Rans coder;
+    coder.create(histogram, N);
+    unsigned int it = coder.write_table(out, N);
+    return it + coder.write(out, in.data(), in.width() * in.height(), N);
+}
+
+unsigned int Process::invertRans(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N) {
+    if (out.width() != width || out.height() != height)
+        out.resize(width, height);
+    Rans coder;
+    unsigned int it = coder.read_table(in, N);
+    return it + coder.read(in, out.data(), width * height);
+}
+
+unsigned int Process::symbolsCost(const std::array<unsigned int, 256>& histogram, unsigned int N, unsigned int maxlen) {
+    bool rans;
+    return symbolsCost(histogram, N, maxlen, rans);
+}
+
+unsigned int Process::symbolsCost(const std::array<unsigned int, 256>& histogram, unsigned int N, unsigned int maxlen, bool& rans) {
+    std::array<unsigned int, 256> folded;
+    folded.fill(0);
+    double total = 0.0, bits = 0.0;
+    for (unsigned int v = 0; v < 256; v++) {
+        folded[v & ((1 << N) - 1)] += histogram[v];
+        total += (double)histogram[v];
+    }
+    for (unsigned int s = 0; s < (1u << N); s++) {
+        if (folded[s])
+            bits += (double)folded[s] * std::log2(total / (double)folded[s]);
+    }
+    // Huffman codes are exact, the range of rANS is close to the entropy (after its final states)
+    Huffman<8> huff;
+    Rans coder;
+    BitWriter tables;
+    huff.create(histogram, N, maxlen);
+    coder.create(histogram, N);
+    unsigned int C1 = huff.write_lengths(tables, N) + (unsigned int)huff.cost(histogram, N),
+                 C2 = coder.write_table(tables, N) + (unsigned int)std::ceil(bits) + Rans::STATES * 32;
+    rans = C2 < C1;
+    return 1 + std::min(C1, C2);
 }
 
 namespace Process {
@@ -446,21 +1038,25 @@ namespace Process {
 void Process::grayCoding(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = grayTable[in[i][j]];
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = grayTable[in[i][j]];
+            }
         }
-    }
+    });
 }
 
 void Process::invertGrayCoding(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out) {
     if (in.width() != out.width() || in.height() != out.height())
         out.resize(in.width(), in.height());
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            out[i][j] = invertGrayTable[in[i][j]];
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (unsigned int i = first; i < last; i++) {
+            for (unsigned int j = 0, w = in.width(); j < w; j++) {
+                out[i][j] = invertGrayTable[in[i][j]];
+            }
         }
-    }
+    });
 }
 
 void Process::getBinary(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int N) {
@@ -484,83 +1080,505 @@ void Process::setBinary(const Bitmap<unsigned char>& in, Bitmap<unsigned char>&
     }
 }
 
-unsigned int Process::arithmeticEncoding(const Bitmap<unsigned char>& in, std::vector<bool>& out, unsigned int N, unsigned int NMAX, unsigned int PSIZE) {
+namespace Process {
+
+    // 8 pixels as a word, the pixel l in the byte l
+    inline uint64_t load8(const unsigned char * p) {
+        uint64_t x = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(&x, p, 8);
+#else
+        for (unsigned int l = 0; l < 8; l++)
+            x |= (uint64_t)p[l] << (l * 8);
+#endif
+        return x;
+    }
+
+    inline void store8(unsigned char * p, uint64_t x) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::memcpy(p, &x, 8);
+#else
+        for (unsigned int l = 0; l < 8; l++)
+            p[l] = (unsigned char)(x >> (l * 8));
+#endif
+    }
+
+    // Or n (up to 64) bits at a bit offset of a words array
+    inline void orBits(uint64_t * words, std::size_t offset, uint64_t bits, unsigned int n) {
+        unsigned int shift = offset % 64;
+        words[offset / 64] |= bits << shift;
+        if (shift + n > 64)
+            words[offset / 64 + 1] |= bits >> (64 - shift);
+    }
+
+    // Read n (up to 64) bits at a bit offset of a words array
+    inline uint64_t getBits(const uint64_t * words, std::size_t offset, unsigned int n) {
+        unsigned int shift = offset % 64;
+        uint64_t bits = words[offset / 64] >> shift;
+        if (shift + n > 64)
+            bits |= words[offset / 64 + 1] << (64 - shift);
+        return (n < 64) ? bits & (((uint64_t)1 << n) - 1) : bits;
+    }
+
+    // Write the bits of the pixels out of the whole blocks (right columns, then bottom rows)
+    void writeEdges(const uint64_t * plane, unsigned int width, unsigned int height, unsigned int PSIZE, BitWriter& out) {
+        unsigned int x = width / PSIZE * PSIZE, y = height / PSIZE * PSIZE;
+        for (unsigned int i = 0; i < height; i++) {
+            std::size_t end = (std::size_t)(i + 1) * width;
+            for (std::size_t k = (std::size_t)i * width + ((i < y) ? x : 0); k < end; k += 64) {
+                unsigned int n = (unsigned int)std::min<std::size_t>(64, end - k);
+                out.write(getBits(plane, k, n), n);
+            }
+        }
+    }
+
+    void readEdges(BitReader& in, uint64_t * plane, unsigned int width, unsigned int height, unsigned int PSIZE) {
+        unsigned int x = width / PSIZE * PSIZE, y = height / PSIZE * PSIZE;
+        for (unsigned int i = 0; i < height; i++) {
+            std::size_t end = (std::size_t)(i + 1) * width;
+            for (std::size_t k = (std::size_t)i * width + ((i < y) ? x : 0); k < end; k += 64) {
+                unsigned int n = (unsigned int)std::min<std::size_t>(64, end - k);
+                orBits(plane, k, in.read(n), n);
+            }
+        }
+    }
+
+    // Prefix parity of the bits of a word, complemented when the parity before the word is odd
+    inline uint64_t prefixParity(uint64_t x, bool odd) {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return odd ? ~x : x;
+    }
+
+#if defined(AVX2_KERNELS)
+    // The bit b of each byte is moved to its top bit, then gathered by movemask (the count of bytes done is returned)
+    __attribute__((target("avx2")))
+    std::size_t toBitplanesAVX2(const unsigned char * data, std::size_t size, std::vector<Bitplane>& planes, unsigned int N) {
+        std::size_t k = 0;
+        for (; k + 32 <= size; k += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(data + k));
+            for (unsigned int b = 0; b < N; b++)
+                planes[b][k / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(x, 7 - b)) << (k % 64);
+        }
+        return k;
+    }
+
+    // Each byte selects its bit of a broadcasted word, the bits set become 0xFF by comparison
+    __attribute__((target("avx2")))
+    std::size_t fromBitplanesAVX2(const std::vector<Bitplane>& planes, unsigned char * data, std::size_t size,
+                                  unsigned int N, unsigned int NMAX, unsigned int mask, unsigned char keep) {
+        std::size_t k = 0;
+        const __m256i select = _mm256_set1_epi64x((long long)0x8040201008040201ull),
+                      spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+        for (; k + 32 <= size; k += 32) {
+            __m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(data + k)), _mm256_set1_epi8((char)keep));
+            for (unsigned int b = NMAX; b < N; b++) {
+                if (((mask >> b) & 0x1) == 0)
+                    continue;
+                __m256i bits = _mm256_shuffle_epi8(_mm256_set1_epi32((int)(uint32_t)(planes[b][k / 64] >> (k % 64))), spread);
+                bits = _mm256_cmpeq_epi8(_mm256_and_si256(bits, select), select);
+                x = _mm256_or_si256(x, _mm256_and_si256(bits, _mm256_set1_epi8((char)(1 << b))));
+            }
+            _mm256_storeu_si256((__m256i *)(data + k), x);
+        }
+        return k;
+    }
+#endif
+
+}
+
+void Process::toBitplanes(const Bitmap<unsigned char>& in, std::vector<Bitplane>& planes, unsigned int N) {
+    std::size_t size = (std::size_t)in.width() * in.height(), k = 0;
+    const unsigned char * data = in.data();
+    planes.resize(N);
+    for (unsigned int b = 0; b < N; b++)
+        planes[b].assign(size / 64 + 2, 0);
+#if defined(AVX2_KERNELS)
+    if (usedSimd() == SIMD_AVX2)
+        k = toBitplanesAVX2(data, size, planes, N);
+#endif
+#if defined(__SSE2__)
+    if (usedSimd() != SIMD_NONE) {
+        for (; k + 16 <= size; k += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(data + k));
+            for (unsigned int b = 0; b < N; b++)
+                planes[b][k / 64] |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_slli_epi16(x, 7 - b)) << (k % 64);
+        }
+    }
+#endif
+    for (; k + 8 <= size; k += 8) {
+        uint64_t x = load8(data + k);
+        for (unsigned int b = 0; b < N; b++)
+            planes[b][k / 64] |= ((((x >> b) & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56) << (k % 64);
+    }
+    for (; k < size; k++) {
+        for (unsigned int b = 0; b < N; b++)
+            planes[b][k / 64] |= (uint64_t)((data[k] >> b) & 0x1) << (k % 64);
+    }
+}
+
+void Process::fromBitplanes(const std::vector<Bitplane>& planes, Bitmap<unsigned char>& out, unsigned int width, unsigned int height,
+                            unsigned int N, unsigned int NMAX, unsigned int mask) {
+    if (out.width() != width || out.height() != height)
+        out.resize(width, height);
+    std::size_t size = (std::size_t)width * height, k = 0;
+    unsigned char * data = out.data();
+    mask &= (1u << N) - (1u << NMAX);
+    unsigned char keep = (unsigned char)~mask;
+#if defined(AVX2_KERNELS)
+    if (usedSimd() == SIMD_AVX2)
+        k = fromBitplanesAVX2(planes, data, size, N, NMAX, mask, keep);
+#endif
+#if defined(__SSE2__)
+    if (usedSimd() != SIMD_NONE) {
+        const __m128i select = _mm_set1_epi64x((long long)0x8040201008040201ull);
+        for (; k + 16 <= size; k += 16) {
+            __m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i *)(data + k)), _mm_set1_epi8((char)keep));
+            for (unsigned int b = NMAX; b < N; b++) {
+                if (((mask >> b) & 0x1) == 0)
+                    continue;
+                unsigned int word = (unsigned int)(planes[b][k / 64] >> (k % 64));
+                __m128i bits = _mm_unpacklo_epi64(_mm_set1_epi8((char)(word & 0xFF)), _mm_set1_epi8((char)((word >> 8) & 0xFF)));
+                bits = _mm_cmpeq_epi8(_mm_and_si128(bits, select), select);
+                x = _mm_or_si128(x, _mm_and_si128(bits, _mm_set1_epi8((char)(1 << b))));
+            }
+            _mm_storeu_si128((__m128i *)(data + k), x);
+        }
+    }
+#endif
+    for (; k + 8 <= size; k += 8) {
+        uint64_t x = load8(data + k) & (0x0101010101010101ull * keep);
+        for (unsigned int b = NMAX; b < N; b++) {
+            if (((mask >> b) & 0x1) == 0)
+                continue;
+            // Spread the 8 bits on the low bit of each byte
+            uint64_t spread = (((planes[b][k / 64] >> (k % 64)) & 0xFF) * 0x0101010101010101ull) & 0x8040201008040201ull;
+            x |= (((spread + 0x00406070787C7E7Full) >> 7) & 0x0101010101010101ull) << b;
+        }
+        store8(data + k, x);
+    }
+    for (; k < size; k++) {
+        unsigned char x = data[k] & keep;
+        for (unsigned int b = NMAX; b < N; b++) {
+            if ((mask >> b) & 0x1)
+                x |= (unsigned char)(((planes[b][k / 64] >> (k % 64)) & 0x1) << b);
+        }
+        data[k] = x;
+    }
+}
+
+unsigned int Process::arithmeticEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX, unsigned int PSIZE, bool edges) {
+    std::vector<Bitplane> planes;
+    toBitplanes(in, planes, N);
+    return arithmeticEncoding(planes, in.width(), in.height(), out, N, NMAX, PSIZE, edges);
+}
+
+// Blocks bits are taken in raster order inside each block, and runs are found on whole words
+unsigned int Process::arithmeticEncoding(const std::vector<Bitplane>& planes, unsigned int width, unsigned int height, BitWriter& out,
+                                         unsigned int N, unsigned int NMAX, unsigned int PSIZE, bool edges) {
     unsigned int KMAX = (unsigned int)std::ceil(std::log2(PSIZE + 1));
-    unsigned int count = out.size();
-    Bitmap<unsigned char> map;
+    unsigned int count = out.size(), bw = width / PSIZE, bh = height / PSIZE;
+    std::size_t area = PSIZE * PSIZE, stride = (area + 63) / 64 + 1;
+    std::vector<uint64_t> words(stride * bw);
+    std::vector<unsigned int> runs(area);
     for (unsigned int b = NMAX; b < N; b++) {
-        getBinary(in, map, b);
-        for (unsigned int i = 0, h = in.height() / PSIZE; i < h; i++) {
-            for (unsigned int j = 0, w = in.width() / PSIZE; j < w; j++) {
-                unsigned int size = 0, maxsize = 0;
-                unsigned char c = map[i * PSIZE][j * PSIZE];
-                for (unsigned int _i = 0; _i < PSIZE; _i++) {
-                    for (unsigned int _j = 0; _j < PSIZE; _j++) {
-                        if (c != map[i * PSIZE + _i][j * PSIZE + _j]) {
-                            size = 0;
-                            c = c ? 0 : 1;
-                        }
-                        size++;
-                        if (size > maxsize)
-                            maxsize = size;
+        const uint64_t * plane = planes[b].data();
+        for (unsigned int i = 0; i < bh; i++) {
+            std::fill(words.begin(), words.end(), 0);
+            for (unsigned int _i = 0; _i < PSIZE; _i++) {
+                std::size_t row = (std::size_t)(i * PSIZE + _i) * width;
+                for (unsigned int j = 0; j < bw; j++) {
+                    for (unsigned int _j = 0; _j < PSIZE; _j += 64) {
+                        unsigned int n = std::min(64u, PSIZE - _j);
+                        orBits(&words[j * stride], _i * PSIZE + _j, getBits(plane, row + j * PSIZE + _j, n), n);
+                    }
+                }
+            }
+            for (unsigned int j = 0; j < bw; j++) {
+                const uint64_t * block = &words[j * stride];
+                unsigned int n = 0, maxsize = 0;
+                std::size_t start = 0;
+                uint64_t carry = block[0] & 0x1;
+                // Runs start where a bit differs from the previous one
+                for (std::size_t w = 0; w * 64 < area; w++) {
+                    uint64_t starts = block[w] ^ ((block[w] << 1) | carry);
+                    carry = block[w] >> 63;
+                    if ((w + 1) * 64 > area)
+                        starts &= ((uint64_t)1 << (area % 64)) - 1;
+                    for (; starts; starts &= starts - 1) {
+                        std::size_t pos = w * 64 + __builtin_ctzll(starts);
+                        runs[n++] = (unsigned int)(pos - start);
+                        maxsize = std::max(maxsize, (unsigned int)(pos - start));
+                        start = pos;
                     }
                 }
+                runs[n++] = (unsigned int)(area - start);
+                maxsize = std::max(maxsize, (unsigned int)(area - start));
                 maxsize = (unsigned int)std::ceil(std::log2(maxsize + 1));
-                for (unsigned int k = 0; k < KMAX; k++)
-                    out.push_back((maxsize >> k) & 0x1);
-                c = map[i * PSIZE][j * PSIZE];
-                out.push_back(c);
-                size = 0;
-                for (unsigned int _i = 0; _i < PSIZE; _i++) {
-                    for (unsigned int _j = 0; _j < PSIZE; _j++) {
-                        if (c != map[i * PSIZE + _i][j * PSIZE + _j]) {
-                            for (unsigned int k = 0; k < maxsize; k++)
-                                out.push_back((size >> k) & 0x1);
-                            size = 0;
-                            c = c ? 0 : 1;
+                out.write(maxsize, KMAX);
+                out.write((block[0] & 0x1) != 0);
+                for (unsigned int r = 0; r < n; r++)
+                    out.write(runs[r], maxsize);
+            }
+        }
+        if (edges)
+            writeEdges(plane, width, height, PSIZE, out);
+    }
+    return out.size() - count;
+}
+
+unsigned int Process::invertArithmeticEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX, unsigned int PSIZE, bool edges) {
+    std::vector<Bitplane> planes(N);
+    unsigned int it = invertArithmeticEncoding(in, planes, width, height, N, NMAX, PSIZE, edges);
+    fromBitplanes(planes, out, width, height, N, NMAX);
+    return it;
+}
+
+unsigned int Process::invertArithmeticEncoding(BitReader& in, std::vector<Bitplane>& planes, unsigned int width, unsigned int height,
+                                               unsigned int N, unsigned int NMAX, unsigned int PSIZE, bool edges) {
+    unsigned int KMAX = (unsigned int)std::ceil(std::log2(PSIZE + 1));
+    std::size_t count = in.position();
+    unsigned int bw = width / PSIZE, bh = height / PSIZE;
+    std::size_t area = PSIZE * PSIZE, stride = (area + 63) / 64 + 1;
+    std::vector<uint64_t> words(stride * bw);
+    if (planes.size() < N)
+        planes.resize(N);
+    for (unsigned int b = NMAX; b < N; b++) {
+        // Pixels out of the whole blocks are left null without edges
+        planes[b].assign((std::size_t)width * height / 64 + 2, 0);
+        uint64_t * plane = planes[b].data();
+        for (unsigned int i = 0; i < bh; i++) {
+            std::fill(words.begin(), words.end(), 0);
+            for (unsigned int j = 0; j < bw; j++) {
+                uint64_t * block = &words[j * stride];
+                unsigned int maxsize = (unsigned int)in.read(KMAX);
+                bool c = in.bit();
+                // Runs starts are marked, then bits are their prefix parity (a null run length fills the end of the block)
+                for (std::size_t pos = in.read(maxsize), size; pos > 0 && pos < area; pos += size) {
+                    block[pos / 64] |= (uint64_t)1 << (pos % 64);
+                    if ((size = in.read(maxsize)) == 0)
+                        break;
+                }
+                for (std::size_t w = 0; w * 64 < area; w++) {
+                    block[w] = prefixParity(block[w], c);
+                    c = (block[w] >> 63) != 0;
+                }
+            }
+            for (unsigned int _i = 0; _i < PSIZE; _i++) {
+                std::size_t row = (std::size_t)(i * PSIZE + _i) * width;
+                for (unsigned int j = 0; j < bw; j++) {
+                    for (unsigned int _j = 0; _j < PSIZE; _j += 64) {
+                        unsigned int n = std::min(64u, PSIZE - _j);
+                        orBits(plane, row + j * PSIZE + _j, getBits(&words[j * stride], _i * PSIZE + _j, n), n);
+                    }
+                }
+            }
+        }
+        if (edges)
+            readEdges(in, plane, width, height, PSIZE);
+    }
+    return in.position() - count;
+}
+
+namespace Process {
+
+    // Bitplane context of a pixel without its west neighbour : north, north west and north east in the plane,
+    // the pixel, its east and south neighbours in the plane above (a bit of the plane above is kept by the mask,
+    // rows out of the image are given as null bits)
+    inline unsigned char pixelContext(const unsigned char * prev, const unsigned char * row, const unsigned char * next,
+                                      unsigned int j, unsigned int w, unsigned int b, unsigned int mask) {
+        unsigned int ctx = (((prev[j] >> b) & 0x1) << 1) | ((((row[j] >> (b + 1)) & mask)) << 4)
+                         | ((((next[j] >> (b + 1)) & mask)) << 6);
+        if (j > 0)
+            ctx |= ((prev[j - 1] >> b) & 0x1) << 2;
+        if (j + 1 < w)
+            ctx |= (((prev[j + 1] >> b) & 0x1) << 3) | ((((row[j + 1] >> (b + 1)) & mask)) << 5);
+        return (unsigned char)ctx;
+    }
+
+}
+
+unsigned int Process::rawEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX) {
+    std::vector<Bitplane> planes;
+    toBitplanes(in, planes, N);
+    return rawEncoding(planes, in.width(), in.height(), out, N, NMAX);
+}
+
+unsigned int Process::rawEncoding(const std::vector<Bitplane>& planes, unsigned int width, unsigned int height, BitWriter& out, unsigned int N, unsigned int NMAX) {
+    unsigned int count = out.size();
+    std::size_t size = (std::size_t)width * height;
+    for (unsigned int b = NMAX; b < N; b++) {
+        for (std::size_t k = 0; k < size; k += 64)
+            out.write(planes[b][k / 64], (unsigned int)std::min<std::size_t>(64, size - k));
+    }
+    return out.size() - count;
+}
+
+unsigned int Process::invertRawEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX) {
+    std::vector<Bitplane> planes(N);
+    unsigned int it = invertRawEncoding(in, planes, width, height, N, NMAX);
+    fromBitplanes(planes, out, width, height, N, NMAX);
+    return it;
+}
+
+unsigned int Process::invertRawEncoding(BitReader& in, std::vector<Bitplane>& planes, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX) {
+    std::size_t count = in.position(), size = (std::size_t)width * height;
+    if (planes.size() < N)
+        planes.resize(N);
+    for (unsigned int b = NMAX; b < N; b++) {
+        planes[b].assign(size / 64 + 2, 0);
+        for (std::size_t k = 0; k < size; k += 64)
+            planes[b][k / 64] = in.read((unsigned int)std::min<std::size_t>(64, size - k));
+    }
+    return in.position() - count;
+}
+
+namespace Process {
+
+    // Pixel and row repeat contexts of a bitplane (the models of the plane b start at b * CONTEXTS)
+    const unsigned int PIXEL_CONTEXTS = 128, CONTEXTS = PIXEL_CONTEXTS + 4;
+
+    // Final bits of the range coder
+    const unsigned int CONTEXT_FLUSH = 40;
+
+    // The context coding of larger planes (in pixels) is estimated on a band of SAMPLE_BAND rows out of SAMPLE_STEP
+    const std::size_t SAMPLED_AREA = 1 << 16;
+    const unsigned int SAMPLE_BAND = 8, SAMPLE_STEP = 2;
+
+    // Bits of the context coding of the bitplanes set in the planes mask, in coding order : each bit is visited with its plane and
+    // its context (a repeated segment of the row above is a single bit, of a repeat context). Only a band of rows out of step is
+    // visited if step > 1 (the repeats restart at each band)
+    template <typename Visit>
+    void visitContexts(const Bitmap<unsigned char>& in, unsigned int N, unsigned int NMAX, unsigned int planes, Visit visit, unsigned int step = 1) {
+        const unsigned int SEGMENT = 16;
+        unsigned int w = in.width(), h = in.height(), segments = (w + SEGMENT - 1) / SEGMENT;
+        std::vector<unsigned char> flags(segments), zeros(w);
+        for (unsigned int b = N; b-- > NMAX; ) {
+            if (((planes >> b) & 0x1) == 0)
+                continue;
+            unsigned int above = (b + 1 < N) ? 0x1 : 0x0;
+            std::fill(flags.begin(), flags.end(), 0);
+            for (unsigned int i = 0; i < h; i++) {
+                if (step > 1) {
+                    if ((i / SAMPLE_BAND) % step != 0)
+                        continue;
+                    if (i % SAMPLE_BAND == 0)
+                        std::fill(flags.begin(), flags.end(), 0);
+                }
+                const unsigned char * row = in.data() + i * w, * prev = (i > 0) ? row - w : 0,
+                                    * north = prev ? prev : zeros.data(), * south = (i + 1 < h) ? row + w : zeros.data();
+                unsigned int west = 0, last = 0;
+                for (unsigned int s = 0, j = 0; s < segments; s++) {
+                    unsigned int end = std::min(j + SEGMENT, w);
+                    if (prev) {
+                        unsigned char same = 1;
+                        for (unsigned int k = j; k < end; k++)
+                            same &= (unsigned char)((((row[k] ^ prev[k]) >> b) & 0x1) ^ 0x1);
+                        visit(b, PIXEL_CONTEXTS + (last | (flags[s] << 1)), same != 0);
+                        flags[s] = last = same;
+                        if (same) {
+                            west = (row[end - 1] >> b) & 0x1;
+                            j = end;
+                            continue;
                         }
-                        size++;
+                    }
+                    for (; j < end; j++) {
+                        unsigned int bit = (row[j] >> b) & 0x1;
+                        visit(b, pixelContext(north, row, south, j, w, b, above) | west, bit != 0);
+                        west = bit;
                     }
                 }
-                for (unsigned int k = 0; k < maxsize; k++)
-                    out.push_back((size >> k) & 0x1);
             }
         }
     }
+
+    // Code lengths of a bit by the probability of its value on 11 bits, in 1 / 256 bits
+    struct BitCosts {
+        uint32_t costs[1 << 11];
+        BitCosts() {
+            costs[0] = 11 << 8;
+            for (unsigned int p = 1; p < (1u << 11); p++)
+                costs[p] = (uint32_t)std::lround(-std::log2(p / 2048.0) * 256.0);
+        }
+    };
+
+}
+
+unsigned int Process::contextEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, unsigned int NMAX, unsigned int planes) {
+    unsigned int count = out.size();
+    std::vector<BitModel> models(N * CONTEXTS);
+    RangeEncoder coder(out);
+    visitContexts(in, N, NMAX, planes, [&](unsigned int b, unsigned int ctx, bool bit) {
+        coder.encode(models[b * CONTEXTS + ctx], bit);
+    });
+    coder.flush();
     return out.size() - count;
 }
 
-unsigned int Process::invertArithmeticEncoding(const std::vector<bool>& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX, unsigned int PSIZE) {
-    unsigned int KMAX = (unsigned int)std::ceil(std::log2(PSIZE + 1));
-    unsigned int count = 0;
+// The models are updated as by the coder, which is left out (the code lengths of the sampled rows are scaled to all the rows)
+unsigned int Process::contextCost(const Bitmap<unsigned char>& in, unsigned int N, unsigned int NMAX, unsigned int planes) {
+    static const BitCosts table;
+    std::vector<BitModel> models(N * CONTEXTS);
+    uint64_t cost = 0;
+    unsigned int h = in.height(), step = ((std::size_t)in.width() * h >= SAMPLED_AREA) ? SAMPLE_STEP : 1, rows = 0;
+    for (unsigned int i = 0; i < h; i++)
+        rows += ((i / SAMPLE_BAND) % step == 0) ? 1 : 0;
+    visitContexts(in, N, NMAX, planes, [&](unsigned int b, unsigned int ctx, bool bit) {
+        BitModel& model = models[b * CONTEXTS + ctx];
+        cost += table.costs[bit ? (1u << 11) - model.prob : model.prob];
+        model.update(bit);
+    }, step);
+    return (unsigned int)((cost * h / rows) >> 8) + CONTEXT_FLUSH;
+}
+
+unsigned int Process::invertContextEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N, unsigned int NMAX, unsigned int planes) {
+    const unsigned int SEGMENT = 16;
+    std::size_t count = in.position();
     if (out.width() != width || out.height() != height)
         out.resize(width, height);
-    Bitmap<unsigned char> map;
-    map.resize(width, height);
-    for (unsigned int b = NMAX; b < N; b++) {
-        for (unsigned int i = 0, h = height / PSIZE; i < h; i++) {
-            for (unsigned int j = 0, w = width / PSIZE; j < w; j++) {
-                unsigned int size = 0, maxsize = 0;
-                for (unsigned int k = 0; k < KMAX; k++, count++)
-                    maxsize |= ((unsigned char)in[count] << k);
-                unsigned char c;
-                c = in[count++] ? 0 : 1;
-                for (unsigned int _i = 0; _i < PSIZE; _i++) {
-                    for (unsigned int _j = 0; _j < PSIZE; _j++) {
-                        if (size == 0) {
-                            for (unsigned int k = 0; k < maxsize; k++, count++)
-                                size |= ((unsigned char)in[count] << k);
-                            c = c ? 0 : 1;
-                        }
-                        size--;
-                        map[i * PSIZE + _i][j * PSIZE + _j] = c;
+    unsigned char mask = (unsigned char)~(((1 << N) - (1 << NMAX)) & planes);
+    for (unsigned int i = 0, size = width * height; i < size; i++)
+        out.data()[i] &= mask;
+    unsigned int segments = (width + SEGMENT - 1) / SEGMENT;
+    std::vector<BitModel> models(N << 7), repeats(N << 2);
+    std::vector<unsigned char> flags(segments), zeros(width);
+    RangeDecoder coder(in);
+    for (unsigned int b = N; b-- > NMAX; ) {
+        if (((planes >> b) & 0x1) == 0)
+            continue;
+        BitModel * plane = &models[b << 7], * repeat = &repeats[b << 2];
+        unsigned int above = (b + 1 < N) ? 0x1 : 0x0;
+        unsigned char bitmask = (unsigned char)(1 << b);
+        std::fill(flags.begin(), flags.end(), 0);
+        for (unsigned int i = 0; i < height; i++) {
+            unsigned char * row = out.data() + i * width, * prev = (i > 0) ? row - width : 0;
+            const unsigned char * north = prev ? prev : zeros.data(), * south = (i + 1 < height) ? row + width : zeros.data();
+            unsigned int west = 0, last = 0;
+            for (unsigned int s = 0, j = 0; s < segments; s++) {
+                unsigned int end = std::min(j + SEGMENT, width);
+                if (prev) {
+                    last = coder.decode(repeat[last | (flags[s] << 1)]) ? 1 : 0;
+                    flags[s] = (unsigned char)last;
+                    if (last) {
+                        for (; j < end; j++)
+                            row[j] |= prev[j] & bitmask;
+                        west = (row[end - 1] >> b) & 0x1;
+                        continue;
                     }
                 }
+                for (; j < end; j++) {
+                    west = coder.decode(plane[pixelContext(north, row, south, j, width, b, above) | west]) ? 1 : 0;
+                    row[j] |= (unsigned char)(west << b);
+                }
             }
         }
-        setBinary(map, out, b);
     }
-    return count;
+    return in.position() - count;
 }
 
 void Process::waveletTransform(const Bitmap<float>& in, Bitmap<float>& out, unsigned int pass) {
@@ -607,35 +1625,201 @@ void Process::invertWaveletTransform(const Bitmap<float>& in, Bitmap<float>& out
     invertFilter(L, R, out);
 }
 
-void Process::mergeGrayscale(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int count) {
-    if (in.width() != out.width() || in.height() != out.height())
-        out.resize(in.width(), in.height());
-    std::array<unsigned int, 256> histo;
-    for (unsigned int i = 0; i < 256; i++)
-        histo[i] = 0;
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            histo[in[i][j]]++;
+namespace Process {
+
+    // Lifting steps of the integer 5/3 wavelet on the columns of n rows spaced by stride (the details on the odd rows), predict then
+    // update with symmetric extension (inverse : the opposite steps in the opposite order), each step on whole rows
+    template <bool inverse>
+    void liftColumns(int * data, unsigned int n, std::size_t stride, unsigned int count) {
+        if (n < 2)
+            return;
+        for (unsigned int pass = 0; pass < 2; pass++) {
+            // Forward : odd rows then even rows, inverse : even rows then odd rows
+            bool predict = (pass == 0) != inverse;
+            for (unsigned int k = predict ? 1 : 0; k < n; k += 2) {
+                int * x = data + k * stride;
+                const int * left = data + (k > 0 ? k - 1 : 1) * stride, * right = data + (k + 1 < n ? k + 1 : k - 1) * stride;
+                if (predict) {
+                    for (unsigned int c = 0; c < count; c++)
+                        x[c] += inverse ? (left[c] + right[c]) >> 1 : -((left[c] + right[c]) >> 1);
+                }
+                else {
+                    for (unsigned int c = 0; c < count; c++)
+                        x[c] += inverse ? -((left[c] + right[c] + 2) >> 2) : (left[c] + right[c] + 2) >> 2;
+                }
+            }
+        }
+    }
+
+    // Same steps on the n values of a row
+    template <bool inverse>
+    void liftLine(int * x, unsigned int n) {
+        if (n < 2)
+            return;
+        // Predict (with the last value mirrored for an even count)
+        auto predict = [&]() {
+            for (unsigned int k = 1; k + 1 < n; k += 2)
+                x[k] += inverse ? (x[k - 1] + x[k + 1]) >> 1 : -((x[k - 1] + x[k + 1]) >> 1);
+            if (n % 2 == 0)
+                x[n - 1] += inverse ? x[n - 2] : -x[n - 2];
+        };
+        // Update (with the first detail mirrored, and the last one for an odd count)
+        auto update = [&]() {
+            x[0] += inverse ? -((x[1] + x[1] + 2) >> 2) : (x[1] + x[1] + 2) >> 2;
+            for (unsigned int k = 2; k + 1 < n; k += 2)
+                x[k] += inverse ? -((x[k - 1] + x[k + 1] + 2) >> 2) : (x[k - 1] + x[k + 1] + 2) >> 2;
+            if (n % 2 == 1)
+                x[n - 1] += inverse ? -((x[n - 2] + x[n - 2] + 2) >> 2) : (x[n - 2] + x[n - 2] + 2) >> 2;
+        };
+        if (inverse) {
+            update();
+            predict();
+        }
+        else {
+            predict();
+            update();
         }
     }
-    unsigned char colors[count];
-    for (unsigned int i = 0, k = 0, cpt = 0, size = in.width() * in.height(); i < 256; i++) {
-        cpt += histo[i];
+
+    // Lifting steps on a row, the even values put before the odd values (or back, then the inverse steps) through a row buffer
+    template <bool inverse>
+    void liftRow(int * data, unsigned int width, std::vector<int>& row) {
+        unsigned int half = (width + 1) / 2;
+        if (width < 2)
+            return;
+        if (inverse) {
+            for (unsigned int k = 0; k < half; k++)
+                row[k * 2] = data[k];
+            for (unsigned int k = half; k < width; k++)
+                row[(k - half) * 2 + 1] = data[k];
+            liftLine<true>(row.data(), width);
+            std::copy(row.begin(), row.begin() + width, data);
+            return;
+        }
+        std::copy(data, data + width, row.begin());
+        liftLine<false>(row.data(), width);
+        for (unsigned int k = 0; k < half; k++)
+            data[k] = row[k * 2];
+        for (unsigned int k = half; k < width; k++)
+            data[k] = row[(k - half) * 2 + 1];
+    }
+
+    // Position of the sample k of a line of n samples once the even samples are put before the odd ones (or back if merge)
+    inline unsigned int splitPosition(unsigned int k, unsigned int n, bool merge) {
+        unsigned int half = (n + 1) / 2;
+        if (merge)
+            return (k < half) ? k * 2 : (k - half) * 2 + 1;
+        return (k % 2 == 0) ? k / 2 : half + k / 2;
+    }
+
+    // Put the even rows of a part of a plane before its odd rows (or back if merge), following the cycles of the permutation with a
+    // single row buffer : the buffer carries a row to its position and takes the row there, until the cycle is back to its start
+    void splitRows(int * data, unsigned int width, unsigned int height, std::size_t stride, bool merge) {
+        std::vector<int> row(width);
+        std::vector<bool> moved(height, false);
+        for (unsigned int start = 0; start < height; start++) {
+            if (moved[start])
+                continue;
+            std::copy(data + start * stride, data + start * stride + width, row.begin());
+            moved[start] = true;
+            for (unsigned int k = splitPosition(start, height, merge); k != start; k = splitPosition(k, height, merge)) {
+                std::swap_ranges(row.begin(), row.end(), data + k * stride);
+                moved[k] = true;
+            }
+            std::copy(row.begin(), row.end(), data + start * stride);
+        }
+    }
+
+}
+
+// Each level lifts the rows of its part of the plane, then its columns on whole rows (the rows are read in order, the threads take
+// bands of columns) and splits the rows
+void Process::liftingTransform(Bitmap<int>& plane, unsigned int levels) {
+    std::size_t stride = plane.width();
+    for (unsigned int l = 0; l < levels; l++) {
+        unsigned int w = (plane.width() + (1u << l) - 1) >> l, h = (plane.height() + (1u << l) - 1) >> l;
+        if (w < 2 && h < 2)
+            break;
+        forRows(w, h, [&](unsigned int first, unsigned int last) {
+            std::vector<int> row(w);
+            for (std::size_t i = first; i < last; i++)
+                liftRow<false>(plane.data() + i * stride, w, row);
+        });
+        forRows(h, w, [&](unsigned int first, unsigned int last) {
+            liftColumns<false>(plane.data() + first, h, stride, last - first);
+        });
+        splitRows(plane.data(), w, h, stride, false);
+    }
+}
+
+void Process::invertLiftingTransform(Bitmap<int>& plane, unsigned int levels) {
+    std::size_t stride = plane.width();
+    for (unsigned int l = levels; l-- > 0; ) {
+        unsigned int w = (plane.width() + (1u << l) - 1) >> l, h = (plane.height() + (1u << l) - 1) >> l;
+        if (w < 2 && h < 2)
+            continue;
+        splitRows(plane.data(), w, h, stride, true);
+        forRows(h, w, [&](unsigned int first, unsigned int last) {
+            liftColumns<true>(plane.data() + first, h, stride, last - first);
+        });
+        forRows(w, h, [&](unsigned int first, unsigned int last) {
+            std::vector<int> row(w);
+            for (std::size_t i = first; i < last; i++)
+                liftRow<true>(plane.data() + i * stride, w, row);
+        });
+    }
+}
+
+std::vector<unsigned char> Process::grayPalette(const std::array<unsigned int, 256>& histogram, unsigned int count) {
+    std::vector<unsigned char> colors(count);
+    if (count == 0)
+        return colors;
+    unsigned int size = 0, k = 0;
+    for (unsigned int i = 0; i < 256; i++)
+        size += histogram[i];
+    for (unsigned int i = 0, cpt = 0; i < 256 && k < count; i++) {
+        cpt += histogram[i];
         if (cpt >= k * size / count)
             colors[k++] = i;
     }
-    for (unsigned int i = 0, h = in.height(); i < h; i++) {
-        for (unsigned int j = 0, w = in.width(); j < w; j++) {
-            unsigned int pos = 0, color = in[i][j];
-            int dist =  ((int)color - (int)colors[0]) * ((int)color - (int)colors[0]),
-                tmp_dist;
-            for (unsigned int k = 1; k < count; k++) {
-                if ((tmp_dist = ((int)color - (int)colors[k]) * ((int)color - (int)colors[k])) < dist) {
-                    dist = tmp_dist;
-                    pos = k;
-                }
+    for (; k < count; k++)
+        colors[k] = colors[k - 1];
+    return colors;
+}
+
+std::array<unsigned char, 256> Process::paletteTable(const std::vector<unsigned char>& palette) {
+    std::array<unsigned char, 256> table;
+    for (unsigned int color = 0; color < 256; color++) {
+        unsigned int pos = 0;
+        int dist = ((int)color - (int)palette[0]) * ((int)color - (int)palette[0]), tmp_dist;
+        for (unsigned int k = 1; k < palette.size(); k++) {
+            if ((tmp_dist = ((int)color - (int)palette[k]) * ((int)color - (int)palette[k])) < dist) {
+                dist = tmp_dist;
+                pos = k;
             }
-            out[i][j] = colors[pos];
         }
+        table[color] = palette[pos];
     }
+    return table;
+}
+
+void Process::applyTable(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, const std::array<unsigned char, 256>& table) {
+    if (in.width() != out.width() || in.height() != out.height())
+        out.resize(in.width(), in.height());
+    std::size_t w = in.width();
+    forRows(in.width(), in.height(), [&](unsigned int first, unsigned int last) {
+        for (std::size_t k = first * w, end = last * w; k < end; k++)
+            out.data()[k] = table[in.data()[k]];
+    });
+}
+
+// The levels are merged by a table of the nearest level of each gray level
+void Process::mergeGrayscale(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int count) {
+    if (count == 0) {
+        out = in;
+        return;
+    }
+    std::array<unsigned int, 256> histo;
+    histogram(in, histo);
+    applyTable(in, out, paletteTable(grayPalette(histo, count)));
 }
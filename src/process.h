@@ -2,11 +2,27 @@
 #define PROCESS_H
 
 #include "bitmap.h"
+#include "bitstream.h"
 
 #include <vector>
+#include <array>
+#include <cstdint>
 
 namespace Process {
 
+    // Instruction sets of the colour conversions and of the bitplanes transposition
+    enum Simd {
+        SIMD_NONE = 0,
+        SIMD_SSE2 = 1,
+        SIMD_AVX2 = 2
+    };
+
+    // Best instruction set of the processor
+    Simd supportedSimd();
+
+    // Instruction set of the colour conversions and of the bitplanes transposition (the supported one by default, a higher one is lowered to it)
+    void useSimd(Simd simd);
+
     void toGrayscale(const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B, Bitmap<unsigned char>& Y);
 
     void toYCrCb(const Bitmap<unsigned char>& R, const Bitmap<unsigned char>& G, const Bitmap<unsigned char>& B,
@@ -14,13 +30,38 @@ namespace Process {
     
     void toRGB(const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitmap<float>& Cb,
                Bitmap<unsigned char>& R, Bitmap<unsigned char>& G, Bitmap<unsigned char>& B);
+
+    // Conversion to interleaved RGB rows (of Y width)
+    void toRGB(const Bitmap<float>& Y, const Bitmap<float>& Cr, const Bitmap<float>& Cb, unsigned char * rgb);
+
+    // Interleaved RGB rows from the planes of the filtered mode in a single pass : the luminance means on 7 bits and differences on 4 bits
+    // (giving 2 x YMeanQ width pixels by row), the chroma on 7 bits reduced 2 times (extended when they miss a row or a column)
+    void filteredRGB(const Bitmap<unsigned char>& YMeanQ, const Bitmap<unsigned char>& YDiffQ, const Bitmap<unsigned char>& CrQ,
+                     const Bitmap<unsigned char>& CbQ, unsigned char * rgb);
+
+    // Interleaved RGB rows from the planes of the merged mode in a single pass : the luminance on 6 bits, the chroma as above
+    void mergedRGB(const Bitmap<unsigned char>& YQ, const Bitmap<unsigned char>& CrQ, const Bitmap<unsigned char>& CbQ, unsigned char * rgb);
+
+    // Conversion of interleaved RGB rows
+    void toYCrCb(const unsigned char * rgb, unsigned int width, unsigned int height, Bitmap<float>& Y, Bitmap<float>& Cr, Bitmap<float>& Cb);
+
+    // Planes of the filtered mode from interleaved RGB rows in a single pass : the luminance (truncated), its means on 7 bits and
+    // its differences on 4 bits (logarithmic) by pairs of pixels, the chroma reduced 2 times on 7 bits
+    void filteredPlanes(const unsigned char * rgb, unsigned int width, unsigned int height, Bitmap<unsigned char>& YQ,
+                        Bitmap<unsigned char>& YMeanQ, Bitmap<unsigned char>& YDiffQ, Bitmap<unsigned char>& CrQ, Bitmap<unsigned char>& CbQ);
     
     float calculatePSNR(const Bitmap<unsigned char>& first, const Bitmap<unsigned char>& second);
 
+    // PSNR of an image and of its values through a table, from the image histogram
+    float calculatePSNR(const std::array<unsigned int, 256>& histogram, const std::array<unsigned char, 256>& table);
+
     void Reduce2(const Bitmap<float>& in, Bitmap<float>& out);
     
     void Enlarge2(const Bitmap<float>& in, Bitmap<float>& out);
 
+    // Enlarge to width x height by repeating the last column and the last row
+    void Extend(const Bitmap<float>& in, Bitmap<float>& out, unsigned int width, unsigned int height);
+
     void Quantify(const Bitmap<float>& in, Bitmap<unsigned char>& out, unsigned int N);
 
     void ReduceQuantify(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int N);
@@ -49,9 +90,23 @@ namespace Process {
     
     void invertFilterUp(const Bitmap<float>& mean, const Bitmap<float>& sub, Bitmap<float>& out);
 
-    unsigned int huffman(const Bitmap<unsigned char>& in, std::vector<bool>& out, unsigned int N = 8);
+    void histogram(const Bitmap<unsigned char>& in, std::array<unsigned int, 256>& out);
+
+    unsigned int huffman(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N = 8, bool canonical = true, unsigned int maxlen = 0);
+
+    unsigned int huffman(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram, bool canonical = true, unsigned int maxlen = 0);
+
+    unsigned int invertHuffman(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8, bool canonical = true);
 
-    unsigned int invertHuffman(const std::vector<bool>& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8);
+    unsigned int rans(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N, const std::array<unsigned int, 256>& histogram);
+
+    unsigned int invertRans(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8);
+
+    // Estimated size in bits of the N low bits of the values by the shortest symbols coder (Huffman codes no longer than maxlen, or rANS)
+    unsigned int symbolsCost(const std::array<unsigned int, 256>& histogram, unsigned int N, unsigned int maxlen);
+
+    // Same, telling whether rANS is the shortest
+    unsigned int symbolsCost(const std::array<unsigned int, 256>& histogram, unsigned int N, unsigned int maxlen, bool& rans);
 
     void grayCoding(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out);
 
@@ -61,14 +116,63 @@ namespace Process {
 
     void setBinary(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int N = 0);
 
-    unsigned int arithmeticEncoding(const Bitmap<unsigned char>& in, std::vector<bool>& out, unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8);
+    // Packed bitplane (bit k of the word k / 64 for the pixel k in raster order)
+    typedef std::vector<uint64_t> Bitplane;
+
+    // Split the N low bitplanes in one pass
+    void toBitplanes(const Bitmap<unsigned char>& in, std::vector<Bitplane>& planes, unsigned int N = 8);
 
-    unsigned int invertArithmeticEncoding(const std::vector<bool>& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8);
+    // Replace the bitplanes from NMAX to N - 1 set in the mask in one pass
+    void fromBitplanes(const std::vector<Bitplane>& planes, Bitmap<unsigned char>& out, unsigned int width, unsigned int height,
+                       unsigned int N = 8, unsigned int NMAX = 0, unsigned int mask = ~0u);
+
+    // Run lengths by blocks of PSIZE x PSIZE pixels (the pixels out of the whole blocks are written raw with edges, lost otherwise)
+    unsigned int arithmeticEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8, bool edges = false);
+
+    unsigned int arithmeticEncoding(const std::vector<Bitplane>& planes, unsigned int width, unsigned int height, BitWriter& out,
+                                    unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8, bool edges = false);
+
+    unsigned int invertArithmeticEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8, bool edges = false);
+
+    unsigned int invertArithmeticEncoding(BitReader& in, std::vector<Bitplane>& planes, unsigned int width, unsigned int height,
+                                          unsigned int N = 8, unsigned int NMAX = 2, unsigned int PSIZE = 8, bool edges = false);
+
+    unsigned int rawEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N = 8, unsigned int NMAX = 2);
+
+    unsigned int rawEncoding(const std::vector<Bitplane>& planes, unsigned int width, unsigned int height, BitWriter& out, unsigned int N = 8, unsigned int NMAX = 2);
+
+    unsigned int invertRawEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8, unsigned int NMAX = 2);
+
+    unsigned int invertRawEncoding(BitReader& in, std::vector<Bitplane>& planes, unsigned int width, unsigned int height, unsigned int N = 8, unsigned int NMAX = 2);
+
+    // Context adaptive range coding of the bitplanes set in the planes mask (the other bitplanes give contexts)
+    unsigned int contextEncoding(const Bitmap<unsigned char>& in, BitWriter& out, unsigned int N = 8, unsigned int NMAX = 2, unsigned int planes = ~0u);
+
+    // Estimated size in bits of the context coding of the bitplanes set in the planes mask (without coding them)
+    unsigned int contextCost(const Bitmap<unsigned char>& in, unsigned int N = 8, unsigned int NMAX = 2, unsigned int planes = ~0u);
+
+    unsigned int invertContextEncoding(BitReader& in, Bitmap<unsigned char>& out, unsigned int width, unsigned int height, unsigned int N = 8, unsigned int NMAX = 2, unsigned int planes = ~0u);
 
     void waveletTransform(const Bitmap<float>& in, Bitmap<float>& out, unsigned int pass = 1);
     
     void invertWaveletTransform(const Bitmap<float>& in, Bitmap<float>& out, unsigned int pass = 1);
 
+    // Integer 5/3 wavelet (lifting with symmetric extension) on levels, in place : each level leaves its approximation in the top left
+    // quarter of its part of the plane and its details at the right, below and below right of it (as waveletTransform), exactly invertible
+    void liftingTransform(Bitmap<int>& plane, unsigned int levels = 1);
+
+    void invertLiftingTransform(Bitmap<int>& plane, unsigned int levels = 1);
+
+    // Palette of count gray levels at the quantiles of an histogram (ended by its last level when the image has fewer levels)
+    std::vector<unsigned char> grayPalette(const std::array<unsigned int, 256>& histogram, unsigned int count = 64);
+
+    // Nearest level of a palette for each gray level (the first one of the nearest levels)
+    std::array<unsigned char, 256> paletteTable(const std::vector<unsigned char>& palette);
+
+    // Values of an image through a table
+    void applyTable(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, const std::array<unsigned char, 256>& table);
+
+    // Gray levels replaced by the nearest level of their palette of count levels
     void mergeGrayscale(const Bitmap<unsigned char>& in, Bitmap<unsigned char>& out, unsigned int count = 64);
 
 }
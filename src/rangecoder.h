@@ -0,0 +1,119 @@
+#ifndef RANGECODER_H
+#define RANGECODER_H
+
+#include <cstdint>
+
+#include "bitstream.h"
+
+// Adaptive binary probability (probability of a null bit on 11 bits)
+class BitModel {
+
+    // Adaptation speed
+    static const unsigned int SHIFT = 4;
+
+public:
+
+    uint16_t prob;
+
+    BitModel() : prob(1 << 10) {}
+
+    // Update the probability after a coded bit
+    void update(bool bit) {
+        unsigned int p = prob, select = 0u - (unsigned int)bit;
+        prob = (uint16_t)(p + ((((1u << 11) - p) >> SHIFT) & ~select) - ((p >> SHIFT) & select));
+    }
+
+};
+
+// Binary range encoder (carry propagation through a cached byte)
+class RangeEncoder {
+
+    // Output stream
+    BitWriter& stream;
+
+    // Range bounds
+    uint64_t low;
+    uint32_t range;
+
+    // Pending byte and count of pending 0xFF bytes after it
+    unsigned char cache;
+    uint64_t pending;
+
+    // Output the top byte of the low bound
+    void shift_low() {
+        if ((uint32_t)low < 0xFF000000u || (low >> 32) != 0) {
+            unsigned char carry = (unsigned char)(low >> 32);
+            stream.write((unsigned char)(cache + carry), 8);
+            for (; pending > 1; pending--)
+                stream.write((unsigned char)(0xFF + carry), 8);
+            pending = 0;
+            cache = (unsigned char)(low >> 24);
+        }
+        pending++;
+        low = (low & 0x00FFFFFFu) << 8;
+    }
+
+public:
+
+    RangeEncoder(BitWriter& s) : stream(s), low(0), range(0xFFFFFFFFu), cache(0), pending(1) {}
+
+    // Encode a bit with an adaptive probability
+    void encode(BitModel& model, bool bit) {
+        uint32_t bound = (range >> 11) * model.prob;
+        if (bit) {
+            low += bound;
+            range -= bound;
+        }
+        else
+            range = bound;
+        model.update(bit);
+        while (range < (1u << 24)) {
+            range <<= 8;
+            shift_low();
+        }
+    }
+
+    // Output the remaining bytes
+    void flush() {
+        for (unsigned int i = 0; i < 5; i++)
+            shift_low();
+    }
+
+};
+
+// Binary range decoder (reads exactly the bytes written by the encoder)
+class RangeDecoder {
+
+    // Input stream
+    BitReader& stream;
+
+    // Range and code value
+    uint32_t range, code;
+
+public:
+
+    RangeDecoder(BitReader& s) : stream(s), range(0xFFFFFFFFu), code(0) {
+        for (unsigned int i = 0; i < 5; i++)
+            code = (code << 8) | stream.byte();
+    }
+
+    // Decode a bit with an adaptive probability
+    bool decode(BitModel& model) {
+        uint32_t bound = (range >> 11) * model.prob;
+        bool bit = code >= bound;
+        // Branchless update : the decoded bits are hardly predictable
+        uint32_t select = 0u - (uint32_t)bit;
+        code -= bound & select;
+        range = (bound & ~select) | ((range - bound) & select);
+        model.update(bit);
+        // A single byte always restores the range since probabilities stay away from the bounds
+        if (range < (1u << 24)) {
+            range <<= 8;
+            code = (code << 8) | stream.byte();
+        }
+        return bit;
+    }
+
+};
+
+#endif // RANGECODER_H
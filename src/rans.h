@@ -0,0 +1,193 @@
+#ifndef __RANS_H__
+#define __RANS_H__
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "bitstream.h"
+
+// Range asymmetric numeral system coder with a static frequency table, elements are coded
+// by interleaved states (element i by state i % STATES) so that decoding steps are independent
+class Rans {
+
+public:
+
+    // Probabilities precision
+    static const unsigned int PROB_BITS = 12;
+
+    // Interleaved states count
+    static const unsigned int STATES = 4;
+
+private:
+
+    // Lower bound of a normalized state (states stay in [LOWER, LOWER << 8))
+    static const uint32_t LOWER = 1u << 23;
+
+    // Decoding slot (element of the probability range, its frequency and its offset in the range)
+    struct Slot {
+        unsigned char symbol;
+        uint16_t freq;
+        uint16_t bias;
+    };
+
+    // Normalized frequencies (summing to 1 << PROB_BITS) and their cumulated sums
+    std::vector<uint32_t> freqs, cumul;
+
+    // Decoding table indexed by the PROB_BITS low bits of a state
+    std::vector<Slot> slots;
+
+    // Compute cumulated frequencies and decoding table
+    void reload() {
+        cumul.assign(freqs.size() + 1, 0);
+        for (std::size_t s = 0; s < freqs.size(); s++)
+            cumul[s + 1] = cumul[s] + freqs[s];
+        slots.resize(1 << PROB_BITS);
+        for (std::size_t s = 0; s < freqs.size(); s++) {
+            for (uint32_t k = cumul[s]; k < cumul[s + 1]; k++) {
+                slots[k].symbol = (unsigned char)s;
+                slots[k].freq = (uint16_t)freqs[s];
+                slots[k].bias = (uint16_t)(k - cumul[s]);
+            }
+        }
+    }
+
+    // Bits count of a value
+    static unsigned int bits(uint32_t value) {
+        unsigned int n = 0;
+        for (; value; value >>= 1)
+            n++;
+        return n;
+    }
+
+public:
+
+    // Create normalized frequencies from elements counts (counts of values wider than elem_size bits are folded)
+    void create(const std::array<unsigned int, 256>& counts, unsigned int elem_size = 8) {
+        unsigned int size = 1 << elem_size;
+        std::vector<uint64_t> folded(size, 0);
+        uint64_t total = 0;
+        for (unsigned int v = 0; v < 256; v++) {
+            folded[v & (size - 1)] += counts[v];
+            total += counts[v];
+        }
+        freqs.assign(size, 0);
+        if (total == 0) {
+            freqs[0] = 1 << PROB_BITS;
+            reload();
+            return;
+        }
+        // Proportional scaling, every counted element keeps a non null frequency
+        uint32_t sum = 0;
+        unsigned int largest = 0;
+        for (unsigned int s = 0; s < size; s++) {
+            if (folded[s] == 0)
+                continue;
+            freqs[s] = std::max<uint32_t>(1, (uint32_t)((folded[s] << PROB_BITS) / total));
+            sum += freqs[s];
+            if (folded[s] > folded[largest])
+                largest = s;
+        }
+        // Rounding errors are taken from the most frequent elements
+        while (sum > (1u << PROB_BITS)) {
+            unsigned int s = largest;
+            for (unsigned int t = 0; t < size; t++) {
+                if (freqs[t] > freqs[s])
+                    s = t;
+            }
+            uint32_t cut = std::min(sum - (1u << PROB_BITS), freqs[s] / 2);
+            freqs[s] -= cut;
+            sum -= cut;
+        }
+        freqs[largest] += (1u << PROB_BITS) - sum;
+        reload();
+    }
+
+    // Write normalized frequencies (each preceded by its bits count)
+    unsigned int write_table(BitWriter& stream, unsigned int elem_size = 8) {
+        std::size_t count = stream.size();
+        for (unsigned int s = 0, size = 1 << elem_size; s < size; s++) {
+            unsigned int n = bits(freqs[s]);
+            stream.write(n, 4);
+            stream.write(freqs[s], n);
+        }
+        return stream.size() - count;
+    }
+
+    // Read normalized frequencies
+    unsigned int read_table(BitReader& stream, unsigned int elem_size = 8) {
+        std::size_t count = stream.position();
+        freqs.assign(1 << elem_size, 0);
+        uint32_t sum = 0;
+        for (unsigned int s = 0, size = 1 << elem_size; s < size; s++) {
+            freqs[s] = (uint32_t)stream.read((unsigned int)stream.read(4));
+            sum += freqs[s];
+        }
+        if (sum != (1u << PROB_BITS)) {
+            // Corrupted table, decode everything as the first element
+            freqs.assign(1 << elem_size, 0);
+            freqs[0] = 1 << PROB_BITS;
+        }
+        reload();
+        return stream.position() - count;
+    }
+
+    // Write data content (final states first, then renormalization bytes in decoding order)
+    unsigned int write(BitWriter& stream, const unsigned char * data, std::size_t count, unsigned int elem_size = 8) {
+        std::size_t start = stream.size();
+        unsigned char mask = (unsigned char)((1 << elem_size) - 1);
+        std::array<uint32_t, STATES> states;
+        states.fill(LOWER);
+        std::vector<unsigned char> bytes;
+        for (std::size_t i = count; i-- > 0; ) {
+            uint32_t& x = states[i % STATES];
+            unsigned int s = data[i] & mask;
+            uint32_t freq = freqs[s], limit = ((LOWER >> PROB_BITS) << 8) * freq;
+            while (x >= limit) {
+                bytes.push_back((unsigned char)x);
+                x >>= 8;
+            }
+            x = ((x / freq) << PROB_BITS) + (x % freq) + cumul[s];
+        }
+        for (unsigned int k = 0; k < STATES; k++)
+            stream.write(states[k], 32);
+        for (std::size_t i = bytes.size(); i-- > 0; )
+            stream.write(bytes[i], 8);
+        return stream.size() - start;
+    }
+
+    // Read data content
+    unsigned int read(BitReader& stream, unsigned char * data, std::size_t count) {
+        std::size_t start = stream.position();
+        const uint32_t mask = (1u << PROB_BITS) - 1;
+        std::array<uint32_t, STATES> states;
+        for (unsigned int k = 0; k < STATES; k++)
+            states[k] = (uint32_t)stream.read(32);
+        std::size_t i = 0;
+        // Independent states are stepped together
+        for (; i + STATES <= count; i += STATES) {
+            for (unsigned int k = 0; k < STATES; k++) {
+                const Slot& slot = slots[states[k] & mask];
+                data[i + k] = slot.symbol;
+                states[k] = slot.freq * (states[k] >> PROB_BITS) + slot.bias;
+            }
+            for (unsigned int k = 0; k < STATES; k++) {
+                while (states[k] < LOWER)
+                    states[k] = (states[k] << 8) | stream.byte();
+            }
+        }
+        for (unsigned int k = 0; i < count; i++, k++) {
+            const Slot& slot = slots[states[k] & mask];
+            data[i] = slot.symbol;
+            states[k] = slot.freq * (states[k] >> PROB_BITS) + slot.bias;
+            while (states[k] < LOWER)
+                states[k] = (states[k] << 8) | stream.byte();
+        }
+        return stream.position() - start;
+    }
+
+};
+
+#endif // __RANS_H__
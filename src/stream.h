@@ -16,6 +16,7 @@
 #define LITESCRIPT_STREAMER_HPP
 
 #include <cstdint>
+#include <cstddef>
 #include <iostream>
 
 namespace LiteScript {
@@ -68,6 +69,16 @@ namespace LiteScript {
             return *this;
         }
 
+        /**
+         * Write a block of bytes
+         *
+         * @param data Bytes to write
+         * @param size Number of bytes
+         */
+        void write(const void * data, std::size_t size) {
+            this->stream.write((const char *)data, size);
+        }
+
     };
 
     template <>
@@ -142,6 +153,18 @@ namespace LiteScript {
             return *this;
         }
 
+        /**
+         * Read a block of bytes
+         *
+         * @param data Destination buffer
+         * @param size Maximum number of bytes
+         * @return Number of bytes read
+         */
+        std::size_t read(void * data, std::size_t size) {
+            this->stream.read((char *)data, size);
+            return (std::size_t)this->stream.gcount();
+        }
+
     };
 
     template <>
@@ -0,0 +1,150 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads running parallel loops : the indices of a loop are taken one at a time by the workers and by the calling thread,
+// which runs the indices of the other pending loops while its own ones end (so a loop can be nested in another one)
+class ThreadPool {
+
+    // Parallel loop
+    struct Job {
+        std::function<void(unsigned int)> task;
+        unsigned int count;
+        std::atomic<unsigned int> next, done;
+    };
+
+    // Worker threads (the calling thread is the last one)
+    std::vector<std::thread> workers;
+
+    // Loops with indices left
+    std::vector<std::shared_ptr<Job>> jobs;
+
+    std::mutex mutex;
+
+    // Signaled when a loop is added or ended
+    std::condition_variable changed;
+
+    bool stop;
+
+    // Loop with indices left (the mutex is locked), ended loops are removed
+    std::shared_ptr<Job> pending() {
+        while (!jobs.empty() && jobs.front()->next.load() >= jobs.front()->count)
+            jobs.erase(jobs.begin());
+        for (const std::shared_ptr<Job>& job : jobs) {
+            if (job->next.load() < job->count)
+                return job;
+        }
+        return std::shared_ptr<Job>();
+    }
+
+    // Run the indices of a loop until none are left
+    void run(Job& job) {
+        for (unsigned int i; (i = job.next++) < job.count; ) {
+            job.task(i);
+            if (++job.done == job.count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                changed.notify_all();
+            }
+        }
+    }
+
+    void work() {
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return stop || (job = pending()) != 0; });
+                if (stop)
+                    return;
+            }
+            run(*job);
+        }
+    }
+
+public:
+
+    // Pool of a threads count (the hardware concurrency if null)
+    explicit ThreadPool(unsigned int threads = 0) : stop(false) {
+        resize(threads);
+    }
+
+    ~ThreadPool() {
+        resize(1);
+    }
+
+    // Threads count, with the calling thread
+    unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+    // Change the threads count (the hardware concurrency if null), without loop running
+    void resize(unsigned int threads) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        stop = false;
+        for (unsigned int t = 1; t < threads; t++)
+            workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+
+    // Run a task for each index from 0 to count - 1, and wait for all of them
+    template <typename Task>
+    void parallelFor(unsigned int count, Task task) {
+        if (workers.empty() || count < 2) {
+            for (unsigned int i = 0; i < count; i++)
+                task(i);
+            return;
+        }
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->task = task;
+        job->count = count;
+        job->next = 0;
+        job->done = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        changed.notify_all();
+        run(*job);
+        while (job->done.load() < count) {
+            std::shared_ptr<Job> other;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return job->done.load() == count || (other = pending()) != 0; });
+            }
+            if (other)
+                run(*other);
+        }
+    }
+
+    // Run a task on bands of rows (from its first row to its last row excluded), a few bands for each thread
+    template <typename Task>
+    void parallelRows(unsigned int height, Task task) {
+        unsigned int bands = std::min(height, 4 * size());
+        parallelFor(bands, [&](unsigned int k) {
+            task((unsigned int)((std::size_t)height * k / bands), (unsigned int)((std::size_t)height * (k + 1) / bands));
+        });
+    }
+
+    // Pool shared by the codecs
+    static ThreadPool& global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+};
+
+#endif // THREAD_POOL_H